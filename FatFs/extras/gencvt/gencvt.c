@@ -0,0 +1,87 @@
+/*------------------------------------------------------------------------*/
+/* Generator of the direct conversion tables of the fixed code pages      */
+/*------------------------------------------------------------------------*/
+/* This program is built with ffunicode.c configured for FF_CODE_PAGE 0 and
+/  FF_CVT_DIRECT 1, so that ff_uni2oem() and ff_oem2uni() convert with the
+/  code tables of any code page. It prints the two-level lookup tables of
+/  every code page to the standard output, in the form they take in
+/  ffunicode.c. Run gencvt.sh to build it and to replace the tables. */
+
+#include <stdio.h>
+#include "ff.h"
+
+#define BLK	64		/* Number of codes in a block (lower 6 bits of the code) */
+
+
+static const WORD CodePages[] = {
+	437, 720, 737, 771, 775, 850, 852, 855, 857, 860, 861, 862, 863, 864, 865, 866, 869,
+	932, 936, 949, 950, 0
+};
+
+static WCHAR Cvt[0x10000];		/* Converted code of each code (0:not in the table) */
+static int Map[0x10000 / BLK];	/* Block of each upper 10 bits of the code */
+
+
+static void put_tables (
+	const char* name,	/* Prefix of the table names ("u2o" or "o2u") */
+	const char* what,	/* Kind of the source code */
+	const char* pre		/* Prefix of the codes in the comments */
+)
+{
+	int b, i, k, n = 1;
+
+
+	for (b = 0; b < 0x10000 / BLK; b++) {	/* Number the blocks with any code in */
+		for (i = 0; i < BLK && !Cvt[b * BLK + i]; i++) ;
+		Map[b] = (i < BLK) ? n++ : 0;
+	}
+
+	printf("static const %s %smap[] = {\t/* Block of each upper 10 bits of the %s code (0:not in the table) */\n", n > 256 ? "WORD" : "BYTE", name, what);
+	for (b = 0; b < 0x10000 / BLK; b += 16) {
+		printf("\t");
+		for (k = 0; k < 16; k++) printf("%d,%s", Map[b + k], k < 15 ? " " : "");
+		printf("\n");
+	}
+	printf("};\n");
+
+	printf("static const WCHAR %sblk[][%d] = {\t/* Blocks of converted codes */\n", name, BLK);
+	printf("\t{\t/* Not in the table */\n\t\t0\n\t},\n");
+	for (b = 0; b < 0x10000 / BLK; b++) {
+		if (!Map[b]) continue;
+		printf("\t{\t/* %s%04X - %s%04X */\n", pre, b * BLK, pre, b * BLK + BLK - 1);
+		for (i = 0; i < BLK; i += 16) {
+			printf("\t\t");
+			for (k = 0; k < 16; k++) {
+				if (Cvt[b * BLK + i + k]) {
+					printf("0x%04X,%s", Cvt[b * BLK + i + k], k < 15 ? " " : "");
+				} else {
+					printf("0,%s", k < 15 ? " " : "");
+				}
+			}
+			printf("\n");
+		}
+		printf("\t},\n");
+	}
+	printf("};\n");
+}
+
+
+int main (void)
+{
+	const WORD *cp;
+	DWORD c;
+
+
+	for (cp = CodePages; *cp; cp++) {
+		ff_cvtinit(*cp);
+		printf("#%s FF_CODE_PAGE == %u\n", cp == CodePages ? "if" : "elif", *cp);
+		for (c = 0; c < 0x10000; c++) Cvt[c] = (c < 0x80) ? 0 : ff_uni2oem(c, *cp);	/* ASCII is not converted */
+		put_tables("u2o", "Unicode", "U+");
+		if (*cp >= 900) {	/* DBCS: also OEM code to Unicode */
+			for (c = 0; c < 0x10000; c++) Cvt[c] = (c < 0x80) ? 0 : ff_oem2uni((WCHAR)c, *cp);
+			put_tables("o2u", "OEM", "0x");
+		}
+	}
+	printf("#endif\n");
+	return 0;
+}
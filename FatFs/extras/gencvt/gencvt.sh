@@ -0,0 +1,28 @@
+#!/bin/sh
+# Regenerate the direct conversion tables of the fixed code pages in
+#   src/ffunicode.c from the code tables of the same file
+# Run it after a change of the code tables: sh extras/gencvt/gencvt.sh
+# Needs gcc, sed and awk
+
+set -e
+here=$( cd "$( dirname "$0" )" && pwd )
+src=$here/../../src
+tmp=$( mktemp -d )
+trap 'rm -rf "$tmp"' EXIT
+
+# build ffunicode.c with the conversion of any code page
+cp "$src/ff.h" "$src/ffunicode.c" "$tmp"
+sed -e 's/^#define[ 	]*FF_CODE_PAGE[ 	].*/#define FF_CODE_PAGE 0/' \
+    -e 's/^#define[ 	]*FF_CVT_DIRECT[ 	].*/#define FF_CVT_DIRECT 1/' \
+    -e 's/^#define[ 	]*FF_USE_LFN[ 	]*0$/#define FF_USE_LFN 1/' \
+    "$src/ffconf.h" > "$tmp/ffconf.h"
+gcc -O2 -I"$tmp" -o "$tmp/gencvt" "$here/gencvt.c" "$tmp/ffunicode.c"
+"$tmp/gencvt" > "$tmp/tables.inc"
+
+# replace the lines between the markers
+awk -v inc="$tmp/tables.inc" '
+/generated by extras\/gencvt\/gencvt.sh/ { print; while(( getline line < inc ) > 0 ) print line; skip = 1; next }
+/End of the generated tables/ { skip = 0 }
+! skip { print }
+' "$src/ffunicode.c" > "$tmp/ffunicode.new"
+cp "$tmp/ffunicode.new" "$src/ffunicode.c"
@@ -0,0 +1,21 @@
+// Arduino core stand-in for the host tests
+// micros() returns the simulated time of the card double (see SdFat.h).
+//   g_tick, when set, is called each time the simulated time moves on,
+//   with the time before the move, so a test can run an "interrupt"
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+inline unsigned long g_us;                       // simulated time in microseconds
+inline void ( * g_tick )( unsigned long from );  // called when the time moves on
+
+inline unsigned long micros() { return g_us; }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+#endif // ARDUINO_H
@@ -0,0 +1,187 @@
+// SD card double for the host tests
+// The card is an image in RAM of g_nsect sectors at g_img. It counts the
+//   commands and the blocks transferred, and can fail the writes on demand.
+// With g_lat set it also models the timing of a card in simulated time
+//   (see micros()): each command takes g_cmdus and each block g_blkus, the
+//   card stays busy g_progus after a write, and g_stallus after every
+//   g_stallEvery-th write, as a card does when it erases. The results of a
+//   benchmark therefore do not depend on the host.
+// g_sleepus makes each block transfer take real time, so that tests with
+//   several threads see the card as a shared resource
+
+#ifndef SDFAT_H
+#define SDFAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <Arduino.h>
+
+struct SPISettings { SPISettings() {} };
+#define SD_SCK_MHZ( x ) SPISettings()
+class SdFatSpiDriver {};
+
+// the card
+inline uint8_t * g_img;                  // image of the card
+inline uint32_t  g_nsect;                // number of sectors of the card
+
+// counters
+inline unsigned long g_cmds;             // number of commands
+inline unsigned long g_blocks;           // number of blocks transferred
+inline unsigned long g_wr;               // number of blocks written
+
+// fault injection and observation
+inline bool g_wrfail;                    // writes fail while set
+inline void ( * g_wrhook )( uint32_t );  // called before each block is written
+
+// timing model
+inline bool g_lat;                       // true to simulate the timing
+inline unsigned long g_cmdus = 100, g_blkus = 40, g_progus = 300;
+inline unsigned long g_stallEvery = 200, g_stallus = 150000;
+inline unsigned long g_busyUntil, g_nwr, g_stalls;
+inline unsigned g_sleepus;               // real time taken by each block
+
+inline void simAdvance( unsigned long us )
+{
+  unsigned long t0 = g_us;
+
+  g_us += us;
+  if( g_tick )
+    g_tick( t0 );
+}
+
+// wait for the end of the programming of a previous write
+inline void simWaitReady()
+{
+  if( g_lat && g_us < g_busyUntil )
+  {
+    g_stalls ++;
+    simAdvance( g_busyUntil - g_us );
+  }
+}
+
+inline void simCommand()
+{
+  g_cmds ++;
+  if( g_lat )
+    simAdvance( g_cmdus );
+}
+
+inline void simBlock()
+{
+  g_blocks ++;
+  if( g_lat )
+    simAdvance( g_blkus );
+  if( g_sleepus )
+    usleep( g_sleepus );
+}
+
+inline void simProgram()
+{
+  if( g_lat )
+    g_busyUntil = g_us + (( ++ g_nwr % g_stallEvery ) == 0 ? g_stallus : g_progus );
+}
+
+class SdSpiCard
+{
+public:
+  bool begin( SdFatSpiDriver *, uint8_t, SPISettings ) { return true; }
+  int  type() const { return 3; }
+  uint32_t cardSize() { return g_nsect; }
+
+  bool readBlock( uint32_t b, uint8_t * d )
+  {
+    simWaitReady();
+    simCommand();
+    simBlock();
+    if( b >= g_nsect )
+      return false;
+    memcpy( d, g_img + 512u * b, 512 );
+    return true;
+  }
+
+  bool writeBlock( uint32_t b, const uint8_t * s )
+  {
+    simWaitReady();
+    simCommand();
+    simBlock();
+    if( ! write( b, s ))
+      return false;
+    simProgram();
+    return true;
+  }
+
+  bool readStart( uint32_t b )
+  {
+    simWaitReady();
+    simCommand();
+    cur = b;
+    inRead = true;
+    return true;
+  }
+
+  bool readData( uint8_t * d )
+  {
+    if( ! inRead || cur >= g_nsect )
+      return false;
+    simBlock();
+    memcpy( d, g_img + 512u * cur ++, 512 );
+    return true;
+  }
+
+  bool readStop() { inRead = false; return true; }
+
+  bool writeStart( uint32_t b, uint32_t )
+  {
+    simWaitReady();
+    simCommand();
+    cur = b;
+    inWrite = true;
+    return true;
+  }
+
+  bool writeData( const uint8_t * s )
+  {
+    if( ! inWrite )
+      return false;
+    simBlock();
+    return write( cur ++, s );
+  }
+
+  bool writeStop()
+  {
+    inWrite = false;
+    simProgram();
+    return true;
+  }
+
+  bool isBusy()
+  {
+    if( g_lat && g_us < g_busyUntil )
+    {
+      simAdvance( 5 );
+      return true;
+    }
+    return false;
+  }
+
+  bool syncBlocks() { return true; }
+
+private:
+  uint32_t cur;
+  bool     inRead, inWrite;
+
+  bool write( uint32_t b, const uint8_t * s )
+  {
+    g_wr ++;
+    if( g_wrhook )
+      g_wrhook( b );
+    if( b >= g_nsect || g_wrfail )
+      return false;
+    memcpy( g_img + 512u * b, s, 512 );
+    return true;
+  }
+};
+
+#endif // SDFAT_H
@@ -0,0 +1,275 @@
+// Test of the batch mode
+// Files are created, overwritten and removed in nested batches. Before
+//   every third write to the card, the image is checked as a crash at that
+//   point would leave it: each chain reachable from the directories must
+//   be allocated in the FAT, end properly and not share clusters with
+//   another chain. Lost clusters are allowed. After the commit the files
+//   must be as written. The cluster of a directory removed in a batch and
+//   reused for file data must not be overwritten by the directory sectors
+//   at the commit.
+// Benchmark: sector writes to create 300 files with and without a batch.
+//   The sectors are coalesced only with the window cache
+
+// config: FF_USE_BATCH=1
+// config: FF_USE_BATCH=1 FF_WIN_CACHE=4
+
+#include "test.h"
+#include <vector>
+
+static const int N = 300;
+
+// consistency of the directory tree and the FAT of an image
+class Volume
+{
+public:
+  int check( const uint8_t * img )
+  {
+    const uint8_t * b;
+    uint32_t vb, rsvd, nfats, fsz, tsect, nclst;
+
+    im = img;
+    vb = img[ 0 ] == 0xEB || img[ 0 ] == 0xE9 ? 0 : w32( img + 446 + 8 );
+    b = img + 512ull * vb;
+    rsvd = w16( b + 14 );
+    nfats = b[ 16 ];
+    nroot = w16( b + 17 );
+    tsect = w16( b + 19 ) ? w16( b + 19 ) : w32( b + 32 );
+    fsz = w16( b + 22 ) ? w16( b + 22 ) : w32( b + 36 );
+    csz = b[ 13 ];
+    fat = vb + rsvd;
+    rootsec = fat + nfats * fsz;
+    data = rootsec + ( nroot * 32 + 511 ) / 512;
+    nclst = ( tsect - ( data - vb )) / csz;
+    nfe = nclst + 2;
+    type = nclst < 4085 ? 12 : nclst < 65525 ? 16 : 32;
+    used.assign( nfe, 0 );
+    errs = 0;
+    if( type == 32 )
+      walk( w32( b + 44 ));
+    else
+      entries( img + 512ull * rootsec, nroot );
+    return errs;
+  }
+
+private:
+  const uint8_t * im;
+  uint32_t fat, nfe, data, csz, rootsec, nroot;
+  int type, errs;
+  std::vector< uint8_t > used;
+
+  static uint16_t w16( const uint8_t * p ) { return p[ 0 ] | p[ 1 ] << 8; }
+  static uint32_t w32( const uint8_t * p ) { return w16( p ) | (uint32_t) w16( p + 2 ) << 16; }
+
+  uint32_t ent( uint32_t c )
+  {
+    const uint8_t * f = im + 512ull * fat;
+
+    if( type == 32 )
+      return w32( f + c * 4 ) & 0x0FFFFFFF;
+    if( type == 16 )
+      return w16( f + c * 2 );
+    uint32_t v = w16( f + c + c / 2 );
+    return c & 1 ? v >> 4 : v & 0xFFF;
+  }
+
+  bool eoc( uint32_t v ) { return type == 32 ? v >= 0x0FFFFFF8 : type == 16 ? v >= 0xFFF8 : v >= 0xFF8; }
+
+  std::vector< uint32_t > chain( uint32_t c )
+  {
+    std::vector< uint32_t > v;
+
+    while( c >= 2 && c < nfe )
+    {
+      if( used[ c ] )
+      {
+        printf( "  cluster %u in two chains\n", c );
+        errs ++;
+        break;
+      }
+      used[ c ] = 1;
+      v.push_back( c );
+      uint32_t n = ent( c );
+      if( n == 0 )
+      {
+        printf( "  free cluster %u in a chain\n", c );
+        errs ++;
+        break;
+      }
+      if( eoc( n ))
+        break;
+      c = n;
+    }
+    return v;
+  }
+
+  void entries( const uint8_t * p, uint32_t n )
+  {
+    for( uint32_t i = 0; i < n; i ++, p += 32 )
+    {
+      if( p[ 0 ] == 0 )
+        return;
+      if( p[ 0 ] == 0xE5 || p[ 0 ] == '.' || p[ 11 ] == 0x0F || ( p[ 11 ] & 0x08 ))
+        continue;
+      uint32_t c = w16( p + 26 ) | ( type == 32 ? (uint32_t) w16( p + 20 ) << 16 : 0 );
+      if( c == 0 )
+        continue;
+      if( p[ 11 ] & 0x10 )
+        walk( c );
+      else
+        chain( c );
+    }
+  }
+
+  void walk( uint32_t c )
+  {
+    for( uint32_t k : chain( c ))
+      entries( im + 512ull * ( data + (uint64_t)( k - 2 ) * csz ), csz * 16 );
+  }
+};
+
+static unsigned long wcount, nsnap, nbad;
+
+static void snapshot( uint32_t b )
+{
+  Volume v;
+
+  if( wcount ++ % 3 == 0 )
+  {
+    nsnap ++;
+    if( v.check( g_img ))
+    {
+      nbad ++;
+      printf( "  inconsistent before write %lu to sector %u\n", wcount, b );
+    }
+  }
+}
+
+static void makeFiles( int base, int n, int len )
+{
+  static char buf[ 3000 ];
+  char name[ 64 ];
+  FileFs f;
+
+  memset( buf, 'x', sizeof buf );
+  for( int i = base; i < base + n; i ++ )
+  {
+    sprintf( name, "/b/file number %d.txt", i );
+    CHECK( f.open( name, FA_WRITE | FA_CREATE_ALWAYS ));
+    CHECK( f.write( buf, len ) == (uint32_t) len );
+    CHECK( f.close());
+  }
+}
+
+static void remount()
+{
+  f_mount( NULL, "", 0 );
+  CHECK( FatFs.begin( 1, SPISettings()));
+}
+
+int main( int argc, char ** argv )
+{
+  char name[ 64 ];
+  unsigned long plain;
+  Volume v;
+  FileFs f;
+
+  loadCard( argc, argv );
+  CHECK( FatFs.mkdir( "/b" ));
+
+  g_wr = 0;
+  makeFiles( 0, N, 100 );
+  plain = g_wr;
+  g_wr = 0;
+  CHECK( FatFs.beginBatch());
+  makeFiles( N, N, 100 );
+  CHECK( FatFs.commitBatch());
+  printf( "%d files: %lu sector writes, %lu in a batch\n", N, plain, g_wr );
+#if FF_WIN_CACHE
+  CHECK( g_wr < plain / 2 );             // dirty sectors are kept in the cache
+#endif
+  CHECK( v.check( g_img ) == 0 );
+
+  // crash snapshots in nested batches: overwrite, remove, create
+  g_wrhook = snapshot;
+  CHECK( FatFs.beginBatch());
+  CHECK( FatFs.beginBatch());
+  makeFiles( 0, N / 2, 2000 );
+  for( int i = N / 2; i < N; i += 2 )
+  {
+    sprintf( name, "/b/file number %d.txt", i );
+    CHECK( FatFs.remove( name ));
+  }
+  CHECK( FatFs.commitBatch());
+  makeFiles( 2 * N, N / 2, 700 );
+  CHECK( FatFs.commitBatch());
+  g_wrhook = NULL;
+  printf( "%lu snapshots, %lu inconsistent\n", nsnap, nbad );
+  CHECK( nsnap > 10 && nbad == 0 );
+  CHECK( v.check( g_img ) == 0 );
+
+  remount();
+  for( int i = 0; i < N; i ++ )
+  {
+    sprintf( name, "/b/file number %d.txt", i );
+    CHECK( FatFs.exists( name ) == ( i < N / 2 || ( i & 1 ) != (( N / 2 ) & 1 )));
+  }
+  for( int i = 0; i < N / 2; i += 7 )
+  {
+    sprintf( name, "/b/file number %d.txt", i );
+    CHECK( f.open( name ));
+    CHECK( f.fileSize() == 2000 );
+    CHECK( f.close());
+  }
+  sprintf( name, "/b/file number %d.txt", 2 * N + 3 );
+  CHECK( f.open( name ));
+  CHECK( f.fileSize() == 700 );
+  CHECK( f.close());
+
+  // the cluster of a directory removed in a batch is reused for file data
+  static uint8_t buf[ 65536 ], rb[ 65536 ];
+  FATFS * fs;
+  DWORD nfree;
+  for( uint32_t k = 0; k < sizeof buf; k ++ )
+    buf[ k ] = (uint8_t)( k * 7 + ( k >> 9 ) * 3 + 1 );
+  for( int round = 0; round < 2; round ++ )
+  {
+    char dir[ 16 ];
+    DIR dj;
+    DWORD dcl;
+
+    CHECK( f_getfree( "", & nfree, & fs ) == FR_OK );
+    uint32_t len = fs->csize * 1024 < sizeof buf ? fs->csize * 1024 : sizeof buf;
+    sprintf( dir, "/rd%d", round );
+    CHECK( FatFs.beginBatch());
+    CHECK( FatFs.mkdir( dir ));
+    for( int i = 0; i < 6; i ++ )
+    {
+      sprintf( name, "%s/entry with a long name %d", dir, i );
+      CHECK( f.open( name, FA_WRITE | FA_CREATE_ALWAYS ));
+      CHECK( f.close());
+    }
+    for( int i = 0; i < 6; i ++ )
+    {
+      sprintf( name, "%s/entry with a long name %d", dir, i );
+      CHECK( FatFs.remove( name ));
+    }
+    CHECK( f_opendir( & dj, dir ) == FR_OK );
+    dcl = dj.obj.sclust;
+    f_closedir( & dj );
+    CHECK( FatFs.rmdir( dir ));
+    fs->last_clst = dcl - 1;             // the next allocation takes the cluster of the directory
+    sprintf( name, "/data%d.bin", round );
+    CHECK( f.open( name, FA_WRITE | FA_CREATE_ALWAYS ));
+    CHECK( f.write( buf, len ) == len );
+    CHECK( f.close());
+    CHECK( FatFs.commitBatch());
+    remount();
+    CHECK( f.open( name, FA_READ ));
+    CHECK( f.read( rb, len ) == len );
+    CHECK( f.close());
+    CHECK( memcmp( rb, buf, len ) == 0 );
+  }
+  CHECK( v.check( g_img ) == 0 );
+
+  return testResult();
+}
@@ -0,0 +1,104 @@
+// Test of the OEM code conversion
+// ff_uni2oem() and ff_oem2uni() are run on every code of the BMP, and the
+//   results are summed up in a digest that must match the one of the
+//   search of the code tables (FF_CVT_DIRECT 0), for the code page of
+//   the configuration, or for every code page with FF_CODE_PAGE 0. A
+//   Unicode code with two OEM codes counts as the lower of them, because
+//   the direct tables and the search may return different ones (cp950).
+// Benchmark: time per character of ff_uni2oem() over random codes
+
+// image: none
+// config: FF_CODE_PAGE=0 FF_CVT_DIRECT=0
+// config: FF_CODE_PAGE=0 FF_CVT_DIRECT=1
+// config: FF_CODE_PAGE=437 FF_CVT_DIRECT=1
+// config: FF_CODE_PAGE=850 FF_CVT_DIRECT=1
+// config: FF_CODE_PAGE=866 FF_CVT_DIRECT=1
+// config: FF_CODE_PAGE=932 FF_CVT_DIRECT=0
+// config: FF_CODE_PAGE=932 FF_CVT_DIRECT=1
+// config: FF_CODE_PAGE=936 FF_CVT_DIRECT=1
+// config: FF_CODE_PAGE=949 FF_CVT_DIRECT=1
+// config: FF_CODE_PAGE=950 FF_CVT_DIRECT=1
+
+#include "test.h"
+
+static const struct
+{
+  WORD     cp;
+  uint32_t u2o, o2u;                     // digests of ff_uni2oem() and ff_oem2uni()
+} Digests[] =
+{
+  { 437, 0x6626EF85, 0xA673E5A5 }, { 720, 0x3A8A69EA, 0x833A7FFE }, { 737, 0xFF7860D5, 0x0D63A65C },
+  { 771, 0xEC7200E1, 0x387F5160 }, { 775, 0x34A0B4A5, 0x3F6501C9 }, { 850, 0x33684775, 0xB368879D },
+  { 852, 0xDEE059C5, 0x9268472E }, { 855, 0x0E42E405, 0x99C3367A }, { 857, 0x2EAE4795, 0xE05BA878 },
+  { 860, 0x8EE23451, 0x48ED06B3 }, { 861, 0xB3338B14, 0x54506FD9 }, { 862, 0x6BE860C5, 0xFF942E98 },
+  { 863, 0xB115BC63, 0x9AED9405 }, { 864, 0xDD782A44, 0x1D764E84 }, { 865, 0x476DD9E1, 0x7A066AF2 },
+  { 866, 0x8AC79CA5, 0x48F38BE9 }, { 869, 0x296B9FFC, 0xA265A844 }, { 932, 0xAF3AC32C, 0x5C4ED895 },
+  { 936, 0x236BAB81, 0xC1D6AF3D }, { 949, 0x9CF04FC8, 0x5D25BC42 }, { 950, 0x9EC19E40, 0xA31AE7FE }
+};
+
+static WCHAR lowest[ 0x10000 ];          // lowest OEM code of each Unicode code
+
+static uint32_t fnv( uint32_t h, uint32_t v )
+{
+  for( int i = 0; i < 4; i ++, v >>= 8 )
+    h = ( h ^ ( v & 0xFF )) * 16777619u;
+  return h;
+}
+
+static void check( WORD cp, uint32_t u2o, uint32_t o2u )
+{
+  uint32_t hu = 2166136261u, ho = 2166136261u;
+  DWORD c;
+
+  memset( lowest, 0, sizeof lowest );
+  for( c = 0xFFFF; c > 0; c -- )
+  {
+    WCHAR u = ff_oem2uni( (WCHAR) c, cp );
+    ho = fnv( ho, u );
+    if( u )
+      lowest[ u ] = (WCHAR) c;
+  }
+  ho = fnv( ho, ff_oem2uni( 0, cp ));
+  for( c = 0; c < 0x10000; c ++ )
+  {
+    WCHAR o = ff_uni2oem( c, cp );
+    if( o && lowest[ c ] && ff_oem2uni( o, cp ) == c )
+      o = lowest[ c ];
+    hu = fnv( hu, o );
+  }
+  for( c = 0x10000; c < 0x110000; c += 0x1001 )   // out of the BMP
+    hu = fnv( hu, ff_uni2oem( c, cp ));
+  if( hu != u2o || ho != o2u )
+  {
+    printf( "code page %u: digests 0x%08X 0x%08X, expected 0x%08X 0x%08X\n", cp, hu, ho, u2o, o2u );
+    fail ++;
+  }
+}
+
+int main()
+{
+  unsigned n = 0;
+
+  for( unsigned i = 0; i < sizeof Digests / sizeof Digests[ 0 ]; i ++ )
+    if( FF_CODE_PAGE == 0 || FF_CODE_PAGE == Digests[ i ].cp )
+    {
+      check( Digests[ i ].cp, Digests[ i ].u2o, Digests[ i ].o2u );
+      n ++;
+    }
+  CHECK( n > 0 );
+
+  // benchmark
+  WORD cp = FF_CODE_PAGE ? FF_CODE_PAGE : 932;
+  static volatile WCHAR sink;
+  uint32_t r = 1;
+  double t = cpuTime();
+  for( int i = 0; i < 1000000; i ++ )
+  {
+    r = r * 1103515245 + 12345;
+    sink = ff_uni2oem( cp >= 900 ? 0x4E00 + ( r >> 16 ) % 0x5000 : 0x80 + ( r >> 16 ) % 0x2500, cp );
+  }
+  t = cpuTime() - t;
+  printf( "ff_uni2oem() for code page %u: %.1f ns per character\n", cp, t * 1000 );
+
+  return testResult();
+}
@@ -0,0 +1,90 @@
+// Test of the disk functions with the card double
+// Requests of several sectors must be sent as one multi-block command,
+//   single sectors with one single-block command, and a failure in the
+//   middle of a transfer must be reported.
+// Benchmark: 1 MB written and read back with the timing model of the card,
+//   by requests of 16 sectors and sector by sector
+
+#include "test.h"
+#include "diskio.h"
+
+static unsigned long failAfter;
+
+static void failHook( uint32_t )
+{
+  if( failAfter > 0 && -- failAfter == 0 )
+    g_wrfail = true;
+}
+
+// time in simulated us to transfer n sectors from sector s by requests of k sectors
+static unsigned long bench( bool wr, uint8_t * buf, uint32_t s, uint32_t n, uint32_t k )
+{
+  unsigned long t0 = g_us;
+
+  for( uint32_t i = 0; i < n; i += k )
+    CHECK(( wr ? disk_write( 0, buf, s + i, k ) : disk_read( 0, buf, s + i, k )) == RES_OK );
+  return g_us - t0;
+}
+
+int main( int argc, char ** argv )
+{
+  static uint8_t wbuf[ 16 * 512 ], rbuf[ 16 * 512 ];
+  uint32_t s;
+
+  loadCard( argc, argv );
+  s = g_nsect - 2048;             // free area at the end of the card
+  for( unsigned i = 0; i < sizeof wbuf; i ++ )
+    wbuf[ i ] = (uint8_t)( i * 7 + i / 511 );
+
+  // single sector
+  g_cmds = g_blocks = 0;
+  CHECK( disk_write( 0, wbuf, s, 1 ) == RES_OK );
+  CHECK( g_cmds == 1 && g_blocks == 1 );
+  g_cmds = g_blocks = 0;
+  CHECK( disk_read( 0, rbuf, s, 1 ) == RES_OK );
+  CHECK( g_cmds == 1 && g_blocks == 1 );
+  CHECK( memcmp( wbuf, rbuf, 512 ) == 0 );
+
+  // several sectors
+  g_cmds = g_blocks = 0;
+  CHECK( disk_write( 0, wbuf, s + 1, 16 ) == RES_OK );
+  CHECK( g_cmds == 1 && g_blocks == 16 );
+  g_cmds = g_blocks = 0;
+  memset( rbuf, 0, sizeof rbuf );
+  CHECK( disk_read( 0, rbuf, s + 1, 16 ) == RES_OK );
+  CHECK( g_cmds == 1 && g_blocks == 16 );
+  CHECK( memcmp( wbuf, rbuf, sizeof wbuf ) == 0 );
+  CHECK( memcmp( g_img + 512u * ( s + 1 ), wbuf, sizeof wbuf ) == 0 );
+
+  // failure in the middle of a multi-block write, and past the end of the card
+  g_wrhook = failHook;
+  failAfter = 5;
+  CHECK( disk_write( 0, wbuf, s + 20, 16 ) != RES_OK );
+  g_wrfail = false;
+  g_wrhook = NULL;
+  CHECK( disk_write( 0, wbuf, s + 20, 16 ) == RES_OK );
+  CHECK( disk_read( 0, rbuf, g_nsect - 8, 16 ) != RES_OK );
+  CHECK( disk_write( 0, wbuf, g_nsect - 8, 16 ) != RES_OK );
+
+  // files on the volume still read back after the raw transfers
+  FileFs f;
+  CHECK( f.open( (char *) "/disk.bin", FA_WRITE | FA_CREATE_ALWAYS ));
+  CHECK( f.write( wbuf, sizeof wbuf ) == sizeof wbuf );
+  CHECK( f.close());
+  memset( rbuf, 0, sizeof rbuf );
+  CHECK( f.open( (char *) "/disk.bin", FA_READ ));
+  CHECK( f.read( rbuf, sizeof rbuf ) == sizeof rbuf );
+  CHECK( f.close());
+  CHECK( memcmp( wbuf, rbuf, sizeof wbuf ) == 0 );
+
+  // benchmark
+  g_lat = true;
+  unsigned long w16 = bench( true, wbuf, s, 2048, 16 ), w1 = bench( true, wbuf, s, 2048, 1 );
+  unsigned long r16 = bench( false, rbuf, s, 2048, 16 ), r1 = bench( false, rbuf, s, 2048, 1 );
+  g_lat = false;
+  printf( "1 MB by 16 sectors: write %lu KB/s, read %lu KB/s\n", 1024000000ul / w16, 1024000000ul / r16 );
+  printf( "1 MB by 1 sector:   write %lu KB/s, read %lu KB/s\n", 1024000000ul / w1, 1024000000ul / r1 );
+  CHECK( w16 < w1 && r16 < r1 );
+
+  return testResult();
+}
@@ -0,0 +1,187 @@
+// Test of the scan of the FAT for free clusters
+// Patterns of free and bad clusters are written in the FAT of the image:
+//   runs of every length, single free entries at the ends of the sectors,
+//   and on FAT32 free entries with the reserved upper 4 bits set. After a
+//   mount, f_getfree() must give the count of free entries read from the
+//   image, and a new file must get the first free clusters in ascending
+//   order.
+// Benchmark: processor time of a full count, and of an allocation on a
+//   nearly full volume with the search starting from cluster 2
+
+// config:
+// config: FF_FAT_BITMAP=512
+
+#include "test.h"
+
+static FATFS * fs;
+
+// FAT entry of cluster c in the image, without the reserved bits
+static DWORD getEnt( DWORD c )
+{
+  uint8_t * p = g_img + 512ull * fs->fatbase;
+
+  if( fs->fs_type == FS_FAT32 )
+    return ( p[ c * 4 ] | p[ c * 4 + 1 ] << 8 | p[ c * 4 + 2 ] << 16 | (DWORD) p[ c * 4 + 3 ] << 24 ) & 0x0FFFFFFF;
+  if( fs->fs_type == FS_FAT16 )
+    return p[ c * 2 ] | p[ c * 2 + 1 ] << 8;
+  DWORD v = p[ c + c / 2 ] | p[ c + c / 2 + 1 ] << 8;
+  return c & 1 ? v >> 4 : v & 0xFFF;
+}
+
+// set the FAT entry of cluster c in both FATs of the image
+static void putEnt( DWORD c, DWORD v )
+{
+  for( unsigned n = 0; n < fs->n_fats; n ++ )
+  {
+    uint8_t * p = g_img + 512ull * ( fs->fatbase + n * fs->fsize );
+
+    if( fs->fs_type == FS_FAT32 )
+      for( int i = 0; i < 4; i ++ )
+        p[ c * 4 + i ] = (uint8_t)( v >> ( 8 * i ));
+    else if( fs->fs_type == FS_FAT16 )
+    {
+      p[ c * 2 ] = (uint8_t) v;
+      p[ c * 2 + 1 ] = (uint8_t)( v >> 8 );
+    }
+    else
+    {
+      DWORD o = c + c / 2, w = p[ o ] | p[ o + 1 ] << 8;
+      w = c & 1 ? ( w & 0x000F ) | ( v << 4 ) : ( w & 0xF000 ) | ( v & 0xFFF );
+      p[ o ] = (uint8_t) w;
+      p[ o + 1 ] = (uint8_t)( w >> 8 );
+    }
+  }
+}
+
+static DWORD bad() { return fs->fs_type == FS_FAT32 ? 0x0FFFFFF7 : fs->fs_type == FS_FAT16 ? 0xFFF7 : 0xFF7; }
+
+static DWORD imgFree()
+{
+  DWORD n = 0;
+
+  for( DWORD c = 2; c < fs->n_fatent; c ++ )
+    n += getEnt( c ) == 0;
+  return n;
+}
+
+// remount the volume and return the free cluster count of f_getfree()
+static DWORD mountFree()
+{
+  DWORD nfree = 0;
+
+  f_mount( NULL, "", 0 );
+  CHECK( FatFs.begin( 1, SPISettings()));
+  CHECK( f_getfree( "", & nfree, & fs ) == FR_OK );
+  return nfree;
+}
+
+// create a file of nclst clusters and check it takes the first free clusters
+//   from cluster 2
+static void checkAlloc( const char * name, DWORD nclst )
+{
+  static uint8_t buf[ 4096 ];
+  DWORD expect = 2, c, n, size = nclst * fs->csize * 512;
+  FIL fil;
+  UINT bw;
+
+  fs->last_clst = 0xFFFFFFFF;            // not the hint of the FSInfo
+  CHECK( f_open( & fil, name, FA_WRITE | FA_CREATE_ALWAYS ) == FR_OK );
+  for( n = 0; n < size; n += bw )
+    if( f_write( & fil, buf, size - n < sizeof buf ? size - n : sizeof buf, & bw ) != FR_OK || bw == 0 )
+      break;
+  CHECK( n == size );
+  CHECK( f_close( & fil ) == FR_OK );
+
+  // walk the chain in the image, the free clusters were taken in order
+  c = fil.obj.sclust;
+  for( n = 0; n < nclst && c >= 2 && c < fs->n_fatent; n ++ )
+  {
+    while( expect < c && getEnt( expect ) != 0 && expect != c )
+      expect ++;
+    if( c != expect )
+    {
+      printf( "cluster %u of %s is %u, first free was %u\n", (unsigned) n, name, (unsigned) c, (unsigned) expect );
+      CHECK( c == expect );
+      break;
+    }
+    expect ++;
+    c = getEnt( c );
+  }
+  CHECK( n == nclst );
+}
+
+int main( int argc, char ** argv )
+{
+  DWORD nfree, c, first, last;
+  uint32_t seed = 1;
+  double t;
+  int i;
+
+  loadCard( argc, argv );
+  CHECK( f_getfree( "", & nfree, & fs ) == FR_OK );
+  CHECK( nfree == imgFree());
+
+  // patterns in the FAT, past the clusters of the root directory
+  first = 64;
+  last = fs->n_fatent;
+  for( c = first; c < last; c ++ )
+  {
+    DWORD region = ( c - first ) / 997, v;
+
+    seed = seed * 1103515245 + 12345;
+    switch( region % 5 )
+    {
+      case 0 :  v = ( seed >> 16 ) % 4 == 0; break;        // mostly free
+      case 1 :  v = ( seed >> 16 ) % 4 != 0; break;        // mostly used
+      case 2 :  v = c & 1; break;                          // every other
+      case 3 :  v = ( c % ( 512 / ( fs->fs_type == FS_FAT32 ? 4 : 2 ))) != 0; break;  // free at the start of the sectors
+      default : v = ( seed >> 16 ) % 23 != 0; break;       // single free entries
+    }
+    if( v )
+      putEnt( c, bad());
+    else if( fs->fs_type == FS_FAT32 && ( seed >> 28 ) & 1 )
+      for( unsigned n = 0; n < fs->n_fats; n ++ )      // free, with reserved bits
+        g_img[ 512ull * ( fs->fatbase + n * fs->fsize ) + c * 4 + 3 ] = (uint8_t)( seed >> 24 ) & 0xF0;
+  }
+  putEnt( last - 1, 0 );
+  nfree = mountFree();
+  printf( "%u free clusters of %u\n", (unsigned) nfree, (unsigned)( fs->n_fatent - 2 ));
+  CHECK( nfree == imgFree());
+
+  // allocations
+  checkAlloc( "/a.bin", 1 );
+  checkAlloc( "/b.bin", 100 );
+  CHECK( mountFree() == imgFree());
+  checkAlloc( "/c.bin", 1000 );
+  CHECK( FatFs.remove( "/b.bin" ));
+  CHECK( mountFree() == imgFree());
+  checkAlloc( "/d.bin", 150 );
+  CHECK( mountFree() == imgFree());
+
+  // benchmark: count
+  t = cpuTime();
+  for( i = 0; i < 20; i ++ )
+    mountFree();
+  t = ( cpuTime() - t ) / 20;
+  printf( "count of %u entries: %.2f ms\n", (unsigned) fs->n_fatent, t * 1000 );
+
+  // benchmark: allocation on a nearly full volume
+  for( c = 2; c < last; c ++ )
+    if( getEnt( c ) == 0 || c >= last - 8 )
+      putEnt( c, c < last - 8 ? bad() : 0 );
+  nfree = mountFree();
+  CHECK( nfree == imgFree());
+  t = cpuTime();
+  for( i = 0; i < 4; i ++ )
+  {
+    char name[ 16 ];
+
+    sprintf( name, "/e%d.bin", i );
+    checkAlloc( name, 1 );
+  }
+  t = ( cpuTime() - t ) / 4;
+  printf( "allocation with %u free clusters: %.2f ms\n", (unsigned) nfree, t * 1000 );
+  CHECK( mountFree() == nfree - 4 );
+
+  return testResult();
+}
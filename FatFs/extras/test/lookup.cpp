@@ -0,0 +1,78 @@
+// Test of the name lookup in large directories
+// f_stat() must find files with long names in directories of thousands
+//   of entries, whatever the case of the name given, for ASCII and
+//   Latin-1 names and names of different lengths, and must not find a
+//   name that is not there.
+// Benchmark: processor time per lookup
+
+// config:
+// config: FF_UPCASE_DIRECT=1
+
+#include "test.h"
+
+static const int N = 1000;
+
+// name i of kind k, with the case of the files created (k < 4) or changed
+static void makeName( char * name, int k, int i )
+{
+  switch( k )
+  {
+    case 0 : sprintf( name, "/many/Sensor_Log_2026_%05d.csv", i ); break;
+    case 1 : sprintf( name, "/many/SENSOR_log_2026_%05d.CSV", i ); break;
+    case 2 : sprintf( name, "/many/\x9A" "bersicht_Daten_%04d.txt", i % ( N / 4 )); break;     // U with diaeresis in code page 437
+    case 3 : sprintf( name, "/many/\x81" "bersicht_daten_%04d.TXT", i % ( N / 4 )); break;     // u with diaeresis
+    default : sprintf( name, "/mix/Photo_%d_%s.jpeg", i * 37, i % 3 ? "a" : "thumbnail_small" );
+  }
+}
+
+int main( int argc, char ** argv )
+{
+  static const char * const Kinds[] = { "exact case ASCII", "mixed case ASCII", "exact case Latin-1", "mixed case Latin-1", "mixed lengths" };
+  char name[ 64 ];
+  FILINFO fi;
+  FIL f;
+
+  loadCard( argc, argv );
+  CHECK( f_mkdir( "/many" ) == FR_OK );
+  CHECK( f_mkdir( "/mix" ) == FR_OK );
+  for( int i = 0; i < N; i ++ )
+  {
+    makeName( name, 0, i );
+    CHECK( f_open( & f, name, FA_WRITE | FA_CREATE_NEW ) == FR_OK && f_close( & f ) == FR_OK );
+    makeName( name, 4, i );
+    CHECK( f_open( & f, name, FA_WRITE | FA_CREATE_NEW ) == FR_OK && f_close( & f ) == FR_OK );
+    if( i < N / 4 )
+    {
+      makeName( name, 2, i );
+      CHECK( f_open( & f, name, FA_WRITE | FA_CREATE_NEW ) == FR_OK && f_close( & f ) == FR_OK );
+    }
+  }
+
+  for( int k = 0; k < 5; k ++ )
+  {
+    double best = 1e9;
+    int found = 0;
+
+    for( int r = 0; r < 5; r ++ )
+    {
+      double t = cpuTime();
+
+      found = 0;
+      for( int i = 0; i < N; i += 7 )
+      {
+        makeName( name, k, i );
+        found += f_stat( name, & fi ) == FR_OK;
+      }
+      t = cpuTime() - t;
+      if( t < best )
+        best = t;
+    }
+    CHECK( found == ( N + 6 ) / 7 );
+    printf( "%-19s %d lookups, %.1f us per lookup\n", Kinds[ k ], found, best * 1e6 / found );
+  }
+  CHECK( f_stat( "/many/sensor_log_2026_99999.csv", & fi ) == FR_NO_FILE );
+  CHECK( f_stat( "/many/Sensor_Log_2026_00001.cs", & fi ) == FR_NO_FILE );
+  CHECK( f_stat( "/many/\x9A" "bersicht_Daten_0001.txtx", & fi ) == FR_NO_FILE );
+
+  return testResult();
+}
@@ -0,0 +1,98 @@
+/*------------------------------------------------------------------------*/
+/* Image maker of the host tests                                          */
+/*------------------------------------------------------------------------*/
+/* Usage: mkimg <file> <sectors> <12|16|32> <cluster size in bytes>
+/  Formats a card image in RAM with f_mkfs() and writes it to the file. The
+/  volume is in a partition, as on an SD card. This program is built with
+/  ff.c configured for FF_USE_MKFS 1 by run.sh. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "diskio.h"
+
+static BYTE* Img;		/* Image of the card */
+static LBA_t NumSect;	/* Number of sectors of the card */
+
+
+DSTATUS disk_status (BYTE pdrv)
+{
+	(void)pdrv;
+	return 0;
+}
+
+DSTATUS disk_initialize (BYTE pdrv)
+{
+	(void)pdrv;
+	return 0;
+}
+
+DRESULT disk_read (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count)
+{
+	(void)pdrv;
+	if (sector + count > NumSect) return RES_PARERR;
+	memcpy(buff, Img + 512 * sector, 512 * count);
+	return RES_OK;
+}
+
+DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count)
+{
+	(void)pdrv;
+	if (sector + count > NumSect) return RES_PARERR;
+	memcpy(Img + 512 * sector, buff, 512 * count);
+	return RES_OK;
+}
+
+DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff)
+{
+	(void)pdrv;
+	switch (cmd) {
+	case CTRL_SYNC:
+		return RES_OK;
+	case GET_SECTOR_COUNT:
+		*(LBA_t*)buff = NumSect;
+		return RES_OK;
+	case GET_BLOCK_SIZE:
+		*(DWORD*)buff = 1;
+		return RES_OK;
+	}
+	return RES_PARERR;
+}
+
+DWORD get_fattime (void)
+{
+	return (DWORD)(2021 - 1980) << 25 | (DWORD)1 << 21 | (DWORD)1 << 16;
+}
+
+
+int main (int argc, char* argv[])
+{
+	static BYTE work[4096];
+	MKFS_PARM opt = { 0, 2, 0, 0, 0 };
+	FRESULT res;
+	FILE *fp;
+
+
+	if (argc != 5) {
+		fprintf(stderr, "usage: mkimg <file> <sectors> <12|16|32> <cluster size>\n");
+		return 2;
+	}
+	NumSect = (LBA_t)strtoul(argv[2], 0, 0);
+	opt.fmt = (atoi(argv[3]) == 32) ? FM_FAT32 : FM_FAT;	/* FAT12 or FAT16 follows the number of clusters */
+	opt.au_size = (DWORD)strtoul(argv[4], 0, 0);
+	Img = calloc(NumSect, 512);
+	if (!Img) return 1;
+
+	res = f_mkfs("", &opt, work, sizeof work);
+	if (res != FR_OK) {
+		fprintf(stderr, "mkimg: f_mkfs() failed (%d)\n", (int)res);
+		return 1;
+	}
+	fp = fopen(argv[1], "wb");
+	if (!fp || fwrite(Img, 512, NumSect, fp) != NumSect || fclose(fp)) {
+		fprintf(stderr, "mkimg: cannot write %s\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,170 @@
+// Test of the numbered short names
+// Files with long names that share the stem of their short name are
+//   created and removed in one directory. The short name of each new file
+//   must be the one of the reference algorithm: the first of NAME~1 to
+//   NAME~99, hashed numbers from ~6 on, that no entry of the directory
+//   uses.
+// Benchmark: sector reads and processor time for the creation of the files
+
+// config:
+// config: FF_DIR_INDEX=64
+
+#include "test.h"
+#include <set>
+#include <string>
+
+static std::set< std::string > sfns;     // short names in the directory
+
+// short name of an ASCII long name, "BODY    EXT"
+static std::string baseName( const char * lfn )
+{
+  const char * dot = strrchr( lfn, '.' );
+  std::string sn( 11, ' ' );
+  int i = 0;
+
+  for( const char * p = lfn; * p && p != dot && i < 8; p ++ )
+    if( * p != ' ' && * p != '.' )
+      sn[ i ++ ] = strchr( "+,;=[]", * p ) ? '_' : toupper( * p );
+  for( i = 8; dot && * ++ dot && i < 11; )
+    if( * dot != ' ' )
+      sn[ i ++ ] = strchr( "+,;=[]", * dot ) ? '_' : toupper( * dot );
+  return sn;
+}
+
+// numbered short name seq of base name sn (gen_numname() of FatFs R0.14)
+static std::string numName( std::string sn, const char * lfn, unsigned seq )
+{
+  char ns[ 8 ];
+  unsigned i, j;
+
+  if( seq > 5 )
+  {
+    uint32_t sreg = seq;
+    for( const char * p = lfn; * p; p ++ )
+    {
+      uint16_t wc = (uint8_t) * p;
+      for( i = 0; i < 16; i ++ )
+      {
+        sreg = ( sreg << 1 ) + ( wc & 1 );
+        wc >>= 1;
+        if( sreg & 0x10000 )
+          sreg ^= 0x11021;
+      }
+    }
+    seq = sreg;
+  }
+  i = 7;
+  do
+  {
+    char c = seq % 16 + '0';
+    ns[ i -- ] = c > '9' ? c + 7 : c;
+    seq /= 16;
+  }
+  while( seq );
+  ns[ i ] = '~';
+  for( j = 0; j < i && sn[ j ] != ' '; j ++ )
+    ;
+  do
+    sn[ j ++ ] = i < 8 ? ns[ i ++ ] : ' ';
+  while( j < 8 );
+  return sn;
+}
+
+// "NAME.EXT" form of FILINFO::altname to "NAME    EXT"
+static std::string fromAlt( const char * alt )
+{
+  std::string sn( 11, ' ' );
+  const char * dot = strchr( alt, '.' );
+
+  for( int i = 0; alt[ i ] && alt + i != dot; i ++ )
+    sn[ i ] = alt[ i ];
+  for( int i = 0; dot && dot[ i + 1 ]; i ++ )
+    sn[ 8 + i ] = dot[ i + 1 ];
+  return sn;
+}
+
+static std::string shortName( const char * path )
+{
+  FILINFO fi;
+
+  if( f_stat( path, & fi ) != FR_OK )
+    return "";
+  return fromAlt( fi.altname );
+}
+
+// create /log/<lfn> and check its short name
+static bool createFile( const char * lfn )
+{
+  std::string path = std::string( "/log/" ) + lfn, base = baseName( lfn ), expect;
+  FileFs f;
+
+  for( unsigned seq = 1; seq < 100 && expect.empty(); seq ++ )
+    if( sfns.count( numName( base, lfn, seq )) == 0 )
+      expect = numName( base, lfn, seq );
+  bool ok = f.open( (char *) path.c_str(), FA_WRITE | FA_CREATE_NEW );
+  CHECK( ok == ! expect.empty());
+  if( ! ok )
+    return false;
+  f.close();
+  std::string got = shortName( path.c_str());
+  if( got != expect )
+  {
+    printf( "%s: %s, expected %s\n", lfn, got.c_str(), expect.c_str());
+    fail ++;
+  }
+  sfns.insert( got );
+  return true;
+}
+
+static void removeFile( const char * lfn )
+{
+  std::string path = std::string( "/log/" ) + lfn;
+
+  sfns.erase( shortName( path.c_str()));
+  CHECK( FatFs.remove( path.c_str()));
+}
+
+int main( int argc, char ** argv )
+{
+  char name[ 80 ];
+  int i;
+
+  loadCard( argc, argv );
+  CHECK( FatFs.mkdir( "/log" ));
+
+  g_blocks = 0;
+  double t = cpuTime();
+  for( i = 0; i < 2000; i ++ )
+  {
+    sprintf( name, "LOG_2026-10-17_%04d.csv", i );
+    CHECK( createFile( name ));
+    if( i % 10 == 9 )
+    {
+      sprintf( name, "LOG_2026-10-17_%04d.csv", i - 4 );
+      removeFile( name );
+    }
+  }
+  t = cpuTime() - t;
+  printf( "2000 files of the same stem: %lu sector reads, %.0f ms\n", g_blocks, t * 1000 );
+
+  // other stems, lossy characters, and numbers freed and taken again
+  for( i = 0; i < 26; i ++ )
+  {
+    sprintf( name, "Same Long Name %c.text", 'a' + i );
+    CHECK( createFile( name ));
+  }
+  for( i = 0; i < 110; i ++ )
+  {
+    sprintf( name, "x+long name %d.a", i );
+    CHECK( createFile( name ));
+  }
+  for( i = 0; i < 20; i ++ )
+  {
+    sprintf( name, "x+long name %d.a", i * 3 );
+    removeFile( name );
+    sprintf( name, "x+long name again %d.a", i );
+    CHECK( createFile( name ));
+  }
+
+  return testResult();
+}
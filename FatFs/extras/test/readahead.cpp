@@ -0,0 +1,169 @@
+// Test of the read-ahead buffer of FileFs
+// Character and number reading, peek and unget, read() after buffered
+//   reads, seeks, and writes after reads in a read/write file must give
+//   the same data as without the buffer, for any buffer size. A file read
+//   character by character must cost one card command per sector at most.
+// Benchmark: processor time to read 300 kB character by character
+
+#include "test.h"
+#include <initializer_list>
+
+static uint8_t pat( uint32_t i ) { return (uint8_t)( i * 7 + ( i >> 9 ) * 13 ); }
+
+int main( int argc, char ** argv )
+{
+  static uint8_t buf[ 4096 ];
+  const uint32_t SZ = 300000 + 77;
+  FileFs f;
+  bool ok;
+
+  loadCard( argc, argv );
+
+  CHECK( f.open( (char *) "/fa.bin", FA_WRITE | FA_CREATE_ALWAYS ));
+  for( uint32_t o = 0; o < SZ; o += 1000 )
+  {
+    uint32_t n = SZ - o < 1000 ? SZ - o : 1000;
+    for( uint32_t k = 0; k < n; k ++ )
+      buf[ k ] = pat( o + k );
+    CHECK( f.write( buf, n ) == n );
+  }
+  CHECK( f.close());
+
+  // sequential reads of any size with any read-ahead size
+  for( int ra : { 0, 1, 4, 16 })
+    for( int rsz : { 1, 37, 200, 700 })
+    {
+      uint32_t o = 0, n, hits, fills;
+
+      CHECK( f.open( (char *) "/fa.bin", FA_READ ));
+      if( ra )
+        CHECK( f.setReadAhead( ra ));
+      ok = true;
+      g_cmds = 0;
+      while(( n = f.read( buf, rsz )) > 0 )
+      {
+        for( uint32_t k = 0; k < n; k ++ )
+          ok &= buf[ k ] == pat( o + k );
+        o += n;
+      }
+      CHECK( ok );
+      CHECK( o == SZ );
+      f.readAheadStats( & hits, & fills );
+      if( rsz == 1 )
+        printf( "read-ahead %2d sectors, reads of 1 byte: %lu commands, %u hits, %u fills\n", ra, g_cmds, hits, fills );
+      CHECK( g_cmds <= SZ / 512 + 16 );
+      CHECK( f.close());
+    }
+
+  // characters, unget, peek and seeks
+  for( int ra : { 0, 8 })
+  {
+    CHECK( f.open( (char *) "/fa.bin", FA_READ ));
+    if( ra )
+      CHECK( f.setReadAhead( ra ));
+    g_cmds = 0;
+    ok = true;
+    for( uint32_t i = 0; i < 20000; i ++ )
+      ok &= (uint8_t) f.readChar() == pat( i );
+    CHECK( g_cmds <= 20000 / 512 + 4 );
+    CHECK( f.ungetChar());
+    CHECK( (uint8_t) f.peekChar() == pat( 19999 ));
+    CHECK( f.curPosition() == 19999 );
+    CHECK( f.read( buf, 10 ) == 10 );
+    for( int k = 0; k < 10; k ++ )
+      ok &= buf[ k ] == pat( 19999 + k );
+    for( int i = 0; i < 200; i ++ )
+    {
+      uint32_t p = ( i * 7919u ) % SZ, n;
+      CHECK( f.seekSet( p ));
+      n = f.read( buf, 100 );
+      for( uint32_t k = 0; k < n; k ++ )
+        ok &= buf[ k ] == pat( p + k );
+      CHECK( f.curPosition() == p + n );
+    }
+    CHECK( ok );
+    CHECK( f.seekSet( SZ - 1 ));
+    CHECK( (uint8_t) f.readChar() == pat( SZ - 1 ));
+    CHECK( f.peekChar() < 0 );
+    CHECK( f.close());
+  }
+
+  // unget after a read() that went around the buffer
+  for( int ra : { 0, 2 })
+  {
+    CHECK( f.open( (char *) "/fa.bin", FA_READ ));
+    if( ra )
+      CHECK( f.setReadAhead( ra ));
+    CHECK( (uint8_t) f.readChar() == pat( 0 ));
+    CHECK( f.read( buf, 2000 ) == 2000 );
+    CHECK( buf[ 0 ] == pat( 1 ) && buf[ 1999 ] == pat( 2000 ));
+    CHECK( f.curPosition() == 2001 );
+    if( f.ungetChar())
+    {
+      CHECK( f.curPosition() == 2000 );
+      CHECK( (uint8_t) f.readChar() == pat( 2000 ));
+    }
+    CHECK( (uint8_t) f.readChar() == pat( 2001 ));
+    CHECK( f.curPosition() == 2002 );
+    CHECK( f.close());
+  }
+
+  // benchmark
+  CHECK( f.open( (char *) "/fa.bin", FA_READ ));
+  double t = cpuTime();
+  ok = true;
+  for( uint32_t i = 0; i < SZ; i ++ )
+    ok &= (uint8_t) f.readChar() == pat( i );
+  t = cpuTime() - t;
+  CHECK( ok );
+  CHECK( f.close());
+  printf( "readChar() of 300 kB: %.1f ms\n", t * 1000 );
+
+  // write after read in a read/write file goes to the next byte not consumed
+  CHECK( f.open( (char *) "/fa.bin", FA_READ | FA_WRITE ));
+  CHECK( f.setReadAhead( 16 ));
+  CHECK( f.read( buf, 33 ) == 33 );
+  CHECK( (uint8_t) f.readChar() == pat( 33 ));
+  CHECK( f.read( buf, 49 ) == 49 );
+  CHECK( f.curPosition() == 83 );
+  CHECK( f.write( (void *) "XYZ", 3 ) == 3 );
+  CHECK( f.writeChar( 'W' ));
+  CHECK( f.seekSet( 80 ));
+  CHECK( f.read( buf, 9 ) == 9 );
+  CHECK( buf[ 2 ] == pat( 82 ) && buf[ 3 ] == 'X' && buf[ 5 ] == 'Z' && buf[ 6 ] == 'W' && buf[ 7 ] == pat( 87 ));
+  CHECK( f.close());
+
+  // numbers and strings
+  CHECK( f.open( (char *) "/t.txt", FA_WRITE | FA_READ | FA_CREATE_ALWAYS ));
+  for( int i = 0; i < 2000; i ++ )
+  {
+    char s[ 40 ];
+    sprintf( s, i & 1 ? "%d,%x,line\r\n" : "%d,%X,line\n", i, i );
+    CHECK( f.writeString( s ) > 0 );
+  }
+  CHECK( f.writeString( (char *) "65535,FfFf" ) == 10 );
+  CHECK( f.seekSet( 0 ));
+  ok = true;
+  for( int i = 0; i < 2000; i ++ )
+  {
+    char ln[ 40 ];
+    ok &= f.readInt() == i;
+    ok &= f.readHex() == i;
+    ok &= f.readString( ln, sizeof ln ) == 4 && strcmp( ln, "line" ) == 0;
+  }
+  CHECK( ok );
+  CHECK( f.readInt() == 65535 );
+  CHECK( f.readHex() == 0xFFFF );     // stops at the end of the file
+  CHECK( f.close());
+  CHECK( f.open( (char *) "/t.txt", FA_READ ));
+  {
+    char ln[ 40 ];
+    int n = 0;
+    while( f.readString( ln, sizeof ln ) >= 0 )
+      n ++;
+    CHECK( n == 2001 );
+  }
+  CHECK( f.close());
+
+  return testResult();
+}
@@ -0,0 +1,76 @@
+#!/bin/sh
+# Host tests of the library, with an SD card double in RAM
+# Usage: sh extras/test/run.sh [test.cpp ...]   (default: all the tests)
+# Each test is built once for each "// config:" line at its top, with the
+#   options of the line applied to a copy of src/ffconf.h (once with the
+#   options as shipped if it has none), and is run on a FAT32, a FAT16 and a
+#   FAT12 image, or once without image if it has a "// image: none" line.
+#   A "// ldflags:" line adds options to the link.
+# OPT gives the compiler options (default: -O1 with the sanitizers), e.g.
+#   OPT=-O2 for the benchmarks. BUILD gives the work directory
+# Needs gcc, g++ and sed
+
+set -e
+here=$( cd "$( dirname "$0" )" && pwd )
+src=$here/../../src
+out=${BUILD:-${TMPDIR:-/tmp}/fatfs-test}
+opt=${OPT:--O1 -g -fsanitize=address,undefined}
+mkdir -p "$out"
+
+# copy the library to $1 and apply the options K=V of the other arguments
+library()
+{
+  dir=$1
+  shift
+  rm -rf "$dir"
+  mkdir -p "$dir"
+  cp "$src"/* "$dir"
+  for kv in "$@"; do
+    sed "s/^#define[ 	]*${kv%%=*}[ 	].*/#define ${kv%%=*} ${kv#*=}/" "$dir/ffconf.h" > "$dir/ffconf.tmp"
+    mv "$dir/ffconf.tmp" "$dir/ffconf.h"
+  done
+}
+
+# make the images once
+if [ ! -f "$out/fat12.img" ]; then
+  library "$out/mkimg" FF_USE_MKFS=1 FF_FS_READONLY=0 FF_FS_REENTRANT=0
+  gcc -O1 -I"$out/mkimg" -o "$out/mkimg/mkimg" "$here/mkimg.c" "$out/mkimg/ff.c" "$out/mkimg/ffunicode.c"
+  "$out/mkimg/mkimg" "$out/fat32.img" 262144 32 1024
+  "$out/mkimg/mkimg" "$out/fat16.img" 131072 16 2048
+  "$out/mkimg/mkimg" "$out/fat12.img" 61440 12 8192
+fi
+
+tests=$*
+[ -n "$tests" ] || tests=$( ls "$here"/*.cpp )
+failed=0
+for t in $tests; do
+  name=$( basename "$t" .cpp )
+  cpp=$here/$name.cpp
+  configs=$( sed -n 's,^// config:,,p' "$cpp" )
+  [ -n "$configs" ] || configs=" "
+  ldflags=$( sed -n 's,^// ldflags:,,p' "$cpp" )
+  images="fat32 fat16 fat12"
+  grep -q '^// image: none' "$cpp" && images=none
+  while read -r config; do
+    b=$out/$name
+    library "$b" $config
+    ( cd "$b" &&
+      gcc $opt -c ff.c ffunicode.c ffsystem.c &&
+      gcc $opt -Wno-implicit-function-declaration -c diskio.c &&
+      g++ -std=c++17 $opt -I"$here" -I. -c FatFs.cpp &&
+      g++ -std=c++17 $opt -I"$here" -I. -o test "$cpp" ff.o ffunicode.o ffsystem.o diskio.o FatFs.o $ldflags -lpthread )
+    for img in $images; do
+      echo "== $name [${config# }] $img"
+      if [ "$img" = none ]; then
+        "$b/test" || { failed=$(( failed + 1 )); echo "** $name failed"; }
+      else
+        "$b/test" "$out/$img.img" || { failed=$(( failed + 1 )); echo "** $name failed"; }
+      fi
+    done
+  done <<EOF
+$configs
+EOF
+done
+
+[ $failed -eq 0 ] && echo "All the tests passed" || echo "$failed runs failed"
+[ $failed -eq 0 ]
@@ -0,0 +1,83 @@
+// Test of FileFs::read() and FileFs::write() with large buffers
+// A whole buffer must go to f_read()/f_write() in one call, so that the
+//   aligned part is transferred cluster by cluster without FIL::buf: about
+//   one card command per cluster, plus the FAT and directory sectors.
+//   Unaligned positions and lengths must read back the data written, and
+//   write() must return when the volume is full.
+
+#include "test.h"
+#include <vector>
+
+int main( int argc, char ** argv )
+{
+  FATFS * fs;
+  DWORD   nfree;
+  FileFs  f;
+
+  loadCard( argc, argv );
+  CHECK( f_getfree( "", & nfree, & fs ) == FR_OK );
+
+  std::vector< uint8_t > big( 300000 ), rd( big.size());
+  for( size_t i = 0; i < big.size(); i ++ )
+    big[ i ] = (uint8_t)( i * 7 + i / 511 );
+  unsigned long nclst = ( big.size() + fs->csize * 512 - 1 ) / ( fs->csize * 512 );
+
+  CHECK( FatFs.mkdir( "/data" ));
+  CHECK( f.open( (char *) "/data/big.bin", FA_WRITE | FA_CREATE_ALWAYS ));
+  g_cmds = 0;
+  CHECK( f.write( big.data(), big.size()) == big.size());
+  CHECK( f.close());
+  printf( "300 kB in %lu clusters: write %lu commands", nclst, g_cmds );
+  CHECK( g_cmds <= nclst + nclst / 4 + 16 );
+
+  CHECK( f.open( (char *) "/data/big.bin", FA_READ ));
+  g_cmds = 0;
+  CHECK( f.read( rd.data(), rd.size()) == rd.size());
+  printf( ", read %lu commands\n", g_cmds );
+  CHECK( g_cmds <= nclst + nclst / 4 + 16 );
+  CHECK( rd == big );
+  CHECK( f.read( rd.data(), 10 ) == 0 );
+
+  // unaligned positions and lengths
+  static const uint32_t pos[] = { 1, 511, 512, 513, 1000, 4095, 123457, 299000 };
+  static const uint32_t len[] = { 1, 510, 512, 1537, 4096, 9999, 1000 };
+  for( unsigned p = 0; p < sizeof pos / sizeof pos[ 0 ]; p ++ )
+    for( unsigned l = 0; l < sizeof len / sizeof len[ 0 ]; l ++ )
+    {
+      uint32_t n = pos[ p ] + len[ l ] <= big.size() ? len[ l ] : big.size() - pos[ p ];
+      CHECK( f.seekSet( pos[ p ] ));
+      CHECK( f.read( rd.data(), len[ l ] ) == n );
+      CHECK( memcmp( rd.data(), & big[ pos[ p ]], n ) == 0 );
+    }
+  CHECK( f.close());
+
+  // overwrite at an unaligned position
+  CHECK( f.open( (char *) "/data/big.bin", FA_WRITE | FA_READ ));
+  CHECK( f.seekSet( 1000 ));
+  CHECK( f.write( & big[ 50000 ], 20000 ) == 20000 );
+  CHECK( f.seekSet( 0 ));
+  CHECK( f.read( rd.data(), rd.size()) == rd.size());
+  CHECK( memcmp( rd.data(), big.data(), 1000 ) == 0 );
+  CHECK( memcmp( & rd[ 1000 ], & big[ 50000 ], 20000 ) == 0 );
+  CHECK( memcmp( & rd[ 21000 ], & big[ 21000 ], big.size() - 21000 ) == 0 );
+  CHECK( f.close());
+
+  // volume full: write() returns what was written
+  CHECK( f_getfree( "", & nfree, & fs ) == FR_OK );
+  uint64_t room = (uint64_t) nfree * fs->csize * 512, total = 0;
+  uint32_t n;
+  CHECK( f.open( (char *) "/fill.bin", FA_WRITE | FA_CREATE_ALWAYS ));
+  do
+  {
+    n = f.write( big.data(), big.size());
+    total += n;
+  }
+  while( n == big.size());
+  CHECK( total == room );
+  CHECK( f.write( big.data(), 1000 ) == 0 );
+  CHECK( f.fileSize() == total );
+  CHECK( f.close());
+  CHECK( FatFs.remove( "/fill.bin" ));
+
+  return testResult();
+}
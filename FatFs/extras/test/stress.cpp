@@ -0,0 +1,154 @@
+// Test of the re-entrancy with the POSIX sync objects
+// Threads write and verify files, list the root directory and read a
+//   shared file at random positions on one volume for a second. Every
+//   check must pass, FatFs.error() must report the result of the calling
+//   thread, and the volume must mount again afterwards. The card double
+//   takes real time for each block, so that the threads contend for it.
+// Benchmark: operations per second and share of the lock requests that
+//   had to wait
+
+// config: FF_FS_REENTRANT=1
+// ldflags: -Wl,--wrap=ff_req_grant
+
+#include "test.h"
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+static std::atomic< unsigned long > ngrant, nwait;
+static std::atomic< bool > stop;
+static std::atomic< unsigned long > nwrite, nlist, nread;
+
+// count the lock requests that have to wait
+extern "C" int __real_ff_req_grant( FF_SYNC_t sobj );
+extern "C" int __wrap_ff_req_grant( FF_SYNC_t sobj )
+{
+  ngrant ++;
+  if( pthread_mutex_trylock( sobj ) == 0 )
+    return 1;
+  nwait ++;
+  return __real_ff_req_grant( sobj );
+}
+
+static uint8_t pat( uint32_t f, uint32_t i ) { return (uint8_t)( i * 7 + f * 31 + ( i >> 9 )); }
+
+static void writer( int id )
+{
+  static thread_local uint8_t b[ 3000 ];
+  char name[ 32 ];
+
+  for( int round = 0; ! stop; round ++ )
+  {
+    uint32_t len = 5000 + id * 1000 + round * 17 % 3000;
+    FileFs f;
+    bool ok = true;
+
+    sprintf( name, "/w%d_%d.bin", id, round % 4 );
+    CHECK( f.open( name, FA_WRITE | FA_READ | FA_CREATE_ALWAYS ));
+    for( uint32_t o = 0; o < len; o += sizeof b )
+    {
+      uint32_t n = len - o < sizeof b ? len - o : sizeof b;
+      for( uint32_t k = 0; k < n; k ++ )
+        b[ k ] = pat( id, o + k );
+      CHECK( f.write( b, n ) == n );
+    }
+    CHECK( f.close());
+    CHECK( f.open( name, FA_READ ));
+    CHECK( f.fileSize() == len );
+    for( uint32_t o = 0, n; o < len && ( n = f.read( b, sizeof b )) > 0; o += n )
+      for( uint32_t k = 0; k < n; k ++ )
+        ok &= b[ k ] == pat( id, o + k );
+    CHECK( ok );
+    CHECK( f.close());
+    nwrite ++;
+  }
+}
+
+static void lister()
+{
+  while( ! stop )
+  {
+    DirFs d;
+    int n = 0;
+
+    CHECK( d.open( (char *) "/" ));
+    while( d.nextFile())
+      n ++;
+    CHECK( n >= 1 );
+    CHECK( d.close());
+    nlist ++;
+  }
+}
+
+static void reader( int id )
+{
+  static thread_local uint8_t b[ 4096 ];
+  unsigned r = id * 7919;
+  FileFs f;
+
+  CHECK( f.open( (char *) "/big.bin", FA_READ ));
+  while( ! stop )
+  {
+    uint32_t p, n;
+    bool ok = true;
+
+    r = r * 1103515245 + 12345;
+    p = ( r >> 8 ) % 200000;
+    CHECK( f.seekSet( p ));
+    n = f.read( b, ( r >> 4 ) % 4000 + 1 );
+    for( uint32_t k = 0; k < n; k ++ )
+      ok &= b[ k ] == pat( 99, p + k );
+    CHECK( ok );
+    nread ++;
+  }
+  CHECK( f.close());
+}
+
+int main( int argc, char ** argv )
+{
+  static uint8_t b[ 1000 ];
+  std::vector< std::thread > th;
+  FATFS * fs;
+  DWORD nfree;
+  FileFs f;
+
+  loadCard( argc, argv );
+  CHECK( f.open( (char *) "/big.bin", FA_WRITE | FA_CREATE_ALWAYS ));
+  for( uint32_t o = 0; o < 210000; o += sizeof b )
+  {
+    for( uint32_t k = 0; k < sizeof b; k ++ )
+      b[ k ] = pat( 99, o + k );
+    CHECK( f.write( b, sizeof b ) == sizeof b );
+  }
+  CHECK( f.close());
+
+  // the result of the last operation is kept per thread
+  CHECK( ! f.open( (char *) "/nothere", FA_READ ));
+  std::thread t( []{ CHECK( FatFs.exists( "/big.bin" )); CHECK( FatFs.error() == FR_OK ); } );
+  t.join();
+  CHECK( FatFs.error() == FR_NO_FILE );
+
+  g_sleepus = 20;
+  for( int i = 0; i < 4; i ++ )
+    th.emplace_back( writer, i );
+  for( int i = 0; i < 4; i ++ )
+    th.emplace_back( reader, i );
+  for( int i = 0; i < 2; i ++ )
+    th.emplace_back( lister );
+  std::this_thread::sleep_for( std::chrono::seconds( 1 ));
+  stop = true;
+  for( auto & x : th )
+    x.join();
+  g_sleepus = 0;
+  printf( "4 writers, 4 readers, 2 listers: %lu files, %lu listings, %lu reads per second; %.1f%% of %lu lock requests waited\n",
+          nwrite.load(), nlist.load(), nread.load(), 100.0 * nwait / ngrant, ngrant.load());
+  CHECK( nwrite > 0 && nlist > 0 && nread > 0 );
+
+  CHECK( f_getfree( "", & nfree, & fs ) == FR_OK );
+  f_mount( NULL, "", 0 );
+  CHECK( FatFs.begin( 1, SPISettings()));
+  CHECK( FatFs.exists( "/big.bin" ));
+
+  return testResult();
+}
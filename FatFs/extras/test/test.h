@@ -0,0 +1,57 @@
+// Common part of the host tests
+// A test is run as "test <image>": loadCard() puts the image in the card
+//   double and mounts it. CHECK() reports a failed condition and the test
+//   goes on; testResult() prints the summary and gives the exit code
+
+#ifndef TEST_H
+#define TEST_H
+
+#include "FatFs.h"
+#include <stdio.h>
+#include <time.h>
+
+static int fail = 0;
+
+#define CHECK( x ) do { if( ! ( x )) { printf( "FAIL %s:%d %s\n", __FILE__, __LINE__, #x ); fail ++; } } while( 0 )
+
+// Load the image of the card given as first argument and mount the volume
+static void loadCard( int argc, char ** argv )
+{
+  FILE * fp;
+
+  if( argc < 2 || ( fp = fopen( argv[ 1 ], "rb" )) == NULL )
+  {
+    printf( "usage: %s <image>\n", argv[ 0 ] );
+    exit( 2 );
+  }
+  fseek( fp, 0, SEEK_END );
+  g_nsect = ftell( fp ) / 512;
+  rewind( fp );
+  g_img = (uint8_t *) malloc( 512u * g_nsect );
+  if( g_img == NULL || fread( g_img, 512, g_nsect, fp ) != g_nsect )
+  {
+    printf( "cannot read %s\n", argv[ 1 ] );
+    exit( 2 );
+  }
+  fclose( fp );
+  if( ! FatFs.begin( 1, SPISettings()))
+  {
+    printf( "cannot mount %s\n", argv[ 1 ] );
+    exit( 2 );
+  }
+}
+
+// Print the summary of the test and return the exit code
+static int testResult()
+{
+  printf( fail ? "FAILED %d\n" : "ALL OK\n", fail );
+  return fail != 0;
+}
+
+// Processor time in seconds, for the benchmarks
+static double cpuTime()
+{
+  return (double) clock() / CLOCKS_PER_SEC;
+}
+
+#endif // TEST_H
@@ -0,0 +1,40 @@
+// Test of the Unicode up-case conversion
+// ff_wtoupper() is run on every code point up to U+10FFFF, and the
+//   results are summed up in a digest that must match the one of the
+//   compressed table of FatFs R0.14, with and without the direct table.
+// Benchmark: time per call of ff_wtoupper() over U+0000 - U+2FFF
+
+// image: none
+// config:
+// config: FF_UPCASE_DIRECT=1
+
+#include "test.h"
+
+static const uint32_t Digest = 0x76ABB291;       // of FatFs R0.14
+
+int main()
+{
+  static volatile DWORD sink;
+  uint32_t h = 2166136261u;
+  DWORD c, u;
+
+  for( c = 0; c < 0x110000; c ++ )
+    for( u = ff_wtoupper( c ), h ^= c; u; u >>= 8 )
+      h = ( h ^ ( u & 0xFF )) * 16777619u;
+  if( h != Digest )
+  {
+    printf( "digest 0x%08X, expected 0x%08X\n", h, Digest );
+    fail ++;
+  }
+  CHECK( ff_wtoupper( 'a' ) == 'A' && ff_wtoupper( 0xE9 ) == 0xC9 && ff_wtoupper( 0x3B1 ) == 0x391 );
+
+  // benchmark
+  double t = cpuTime();
+  for( int i = 0; i < 100; i ++ )
+    for( c = 0; c < 0x3000; c ++ )
+      sink = ff_wtoupper( c );
+  t = cpuTime() - t;
+  printf( "ff_wtoupper(): %.1f ns per call\n", t * 1e9 / ( 100 * 0x3000 ));
+
+  return testResult();
+}
@@ -0,0 +1,148 @@
+// Test of WriterFs
+// A sampling "interrupt" puts a 32-byte sample every millisecond of
+//   simulated time while the loop calls poll(), against a card that stays
+//   busy after each write and stalls now and then. When the ring overruns,
+//   the samples dropped must be counted exactly, and the file must hold
+//   every sample taken, in order and intact. flush() must be a barrier and
+//   a WriterFs must refuse puts and polls after end().
+// Benchmark: samples dropped and longest write for several ring sizes
+
+// config:
+// config: FF_USE_EXPAND=1
+
+#include "test.h"
+
+struct Sample
+{
+  uint32_t seq, t;
+  uint8_t  pad[ 24 ];
+};
+
+static WriterFs * writer;
+static uint32_t seq, taken;
+static bool inIsr;
+
+// called by the card double when the simulated time moves on
+static void isr( unsigned long t0 )
+{
+  if( writer == NULL || inIsr )
+    return;
+  inIsr = true;
+  for( unsigned long t = ( t0 / 1000 + 1 ) * 1000; t <= g_us; t += 1000 )
+  {
+    Sample s;
+
+    s.seq = seq ++;
+    s.t = t;
+    memset( s.pad, (uint8_t) s.seq, sizeof s.pad );
+    if( writer->put( & s, sizeof s ) == sizeof s )
+      taken ++;
+  }
+  inIsr = false;
+}
+
+// sample for dur us into a ring of nbuf buffers of nsect sectors, return the bytes lost
+static uint32_t run( int nbuf, int nsect, bool prealloc, unsigned long dur )
+{
+  uint32_t lost, maxus, prev = 0, n = 0;
+  uint8_t hw;
+  unsigned long t0;
+  char name[ 32 ];
+  FileFs f;
+  WriterFs w;
+  Sample s;
+  bool ok = true;
+
+  sprintf( name, "/w%d_%d.bin", nbuf, nsect );
+  CHECK( f.open( name, FA_READ | FA_WRITE | FA_CREATE_ALWAYS ));
+#if FF_USE_EXPAND
+  if( prealloc )
+    CHECK( f.preallocate( dur / 1000 * sizeof( Sample ) + 65536 ));
+#else
+  prealloc = false;
+#endif
+  CHECK( w.begin( & f, nbuf, nsect ));
+  seq = taken = 0;
+  g_lat = true;
+  g_stallEvery = 40;
+  g_stalls = g_nwr = 0;
+  g_tick = isr;
+  writer = & w;
+  for( t0 = g_us; g_us - t0 < dur; )
+  {
+    CHECK( w.poll());
+    simAdvance( 20 );                    // the rest of the loop
+  }
+  writer = NULL;
+  g_tick = NULL;
+  CHECK( w.flush());
+  g_lat = false;
+  w.stats( & lost, & hw, & maxus );
+  CHECK( w.end());
+  printf( "%d x %2d sectors%s: %u samples, %u bytes dropped, high water %u, longest write %u us, %lu card stalls\n",
+          nbuf, nsect, prealloc ? " preallocated" : "", seq, lost, hw, maxus, g_stalls );
+  CHECK( lost == ( seq - taken ) * sizeof( Sample ));
+  CHECK( f.close());
+
+  CHECK( f.open( name, FA_READ ));
+  CHECK( f.fileSize() == taken * sizeof( Sample ));
+  while( f.read( & s, sizeof s ) == sizeof s )
+  {
+    if( n && s.seq <= prev )
+      ok = false;
+    for( unsigned k = 0; k < sizeof s.pad; k ++ )
+      ok &= s.pad[ k ] == (uint8_t) s.seq;
+    prev = s.seq;
+    n ++;
+  }
+  CHECK( ok );
+  CHECK( n == taken );
+  CHECK( f.close());
+  return lost;
+}
+
+int main( int argc, char ** argv )
+{
+  char b[ 100 ];
+  FileFs f;
+  WriterFs w;
+  bool ok = true;
+
+  loadCard( argc, argv );
+
+  CHECK( run( 2, 1, false, 3000000 ) > 0 );   // too small for the stalls of the card
+  run( 2, 8, false, 3000000 );
+  CHECK( run( 4, 8, true, 3000000 ) == 0 );
+  CHECK( run( 3, 16, true, 3000000 ) == 0 );
+
+  // flush() while the loop puts data, with partly filled buffers
+  CHECK( f.open( (char *) "/fl.bin", FA_WRITE | FA_READ | FA_CREATE_ALWAYS ));
+  CHECK( w.begin( & f, 3, 2 ));
+  for( int i = 0; i < 50; i ++ )
+  {
+    memset( b, 'A' + i % 26, sizeof b );
+    CHECK( w.put( b, sizeof b ) == sizeof b );
+    CHECK( w.poll());
+    if( i % 7 == 0 )
+    {
+      CHECK( w.flush());
+      CHECK( f.fileSize() == ( i + 1 ) * sizeof b );
+    }
+  }
+  CHECK( w.end());
+  CHECK( f.fileSize() == 50 * sizeof b );
+  CHECK( f.seekSet( 0 ));
+  for( int i = 0; i < 50; i ++ )
+  {
+    CHECK( f.read( b, sizeof b ) == sizeof b );
+    for( unsigned k = 0; k < sizeof b; k ++ )
+      ok &= b[ k ] == 'A' + i % 26;
+  }
+  CHECK( ok );
+  CHECK( w.put( b, 1 ) == 0 );
+  CHECK( ! w.poll());
+  CHECK( ! w.begin( & f, 1, 1 ));
+  CHECK( f.close());
+
+  return testResult();
+}
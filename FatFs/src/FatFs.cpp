@@ -55,26 +55,53 @@ extern "C" int sd_initialize()
   return 0;
 }
 
+// Read count sectors starting at sector
+// Several sectors are transfered with a single multi-block read command,
+//   so the command/response cycle is paid once per request and not per sector
+
 extern "C" int sd_disk_read( uint8_t * buff, uint32_t sector, uint32_t count )
 {
-  uint8_t * b = buff;
+  if( count == 1 )
+    return card.readBlock( sector, buff ) ? 0 : 1;
 
-  for( uint32_t n = 0; n < count; n ++ )
-{
-    if( card.readBlock( sector + n, b ) == 0 )
+#ifdef ESP8266
+  // Sd2Card of Esp8266 SD library has no multi-block read
+  for( uint32_t n = 0; n < count; n ++, buff += FF_MIN_SS )
+    if( card.readBlock( sector + n, buff ) == 0 )
       return 1;
-}
   return 0;
+#else
+  if( ! card.readStart( sector ))
+    return 1;
+  for( uint32_t n = 0; n < count; n ++, buff += FF_MIN_SS )
+    if( ! card.readData( buff ))
+    {
+      card.readStop();
+      return 1;
+    }
+  return card.readStop() ? 0 : 1;
+#endif
 }
 
-extern "C" int sd_disk_write( uint8_t * buff, uint32_t sector, uint32_t count )
+// Write count sectors starting at sector
+// Several sectors are transfered with a single multi-block write command.
+//   count is given to the card as pre-erase hint, so it can prepare
+//   the whole area before data arrives
+
+extern "C" int sd_disk_write( const uint8_t * buff, uint32_t sector, uint32_t count )
 {
-  uint8_t * b = buff;
-  
-  for( int n = 0; n < count; n ++ )
-    if( card.writeBlock( sector + n, b ) == 0 )
+  if( count == 1 )
+    return card.writeBlock( sector, buff ) ? 0 : 1;
+
+  if( ! card.writeStart( sector, count ))
+    return 1;
+  for( uint32_t n = 0; n < count; n ++, buff += FF_MIN_SS )
+    if( ! card.writeData( buff ))
+    {
+      card.writeStop();
       return 1;
-  return 0;
+    }
+  return card.writeStop() ? 0 : 1;
 }
 
 extern "C" int sd_disk_ioctl( uint8_t cmd )
@@ -92,6 +119,7 @@ extern "C" int sd_disk_ioctl( uint8_t cmd )
     default:  
       res = RES_PARERR;  
   }
+  return res;
 }
 
 extern "C" DWORD get_fattime( void )
@@ -115,8 +143,17 @@ extern "C" void ff_memfree (void* mblock)
 
    =========================================================== */
 
+// Result of the last operation. With re-entrancy, each task has its own
+#if FF_FS_REENTRANT
+thread_local
+#endif
 uint8_t ffs_result;
 
+// Maximum number of bytes given to f_read() or f_write() in one call
+// (UINT may be 16 bits wide). Keep it a multiple of sector size
+
+#define FFS_MAX_CHUNK ( (uint32_t)(UINT) -1 & ~ (uint32_t)( FF_MIN_SS - 1 ))
+
 // Initialize SD card and file system
 //   csPin : SD card chip select pin
 //   speed : SPI speed = SPI_HALF_SPEED (default), SPI_FULL_SPEED
@@ -158,6 +195,57 @@ int32_t FatFsClass::free()
   return fre_clust * ffs.csize >> 1; // >> 11;
 }
 
+#if FF_USE_FREESCAN
+// Count free clusters a few FAT sectors at a time, so that free() returns
+//   at once afterwards instead of scanning the whole FAT
+// Until the count is complete, free() returns the count found in the FSINFO
+//   sector of FAT32 volumes if FF_FS_NOFSINFO trusts it, else free() scans
+//   the rest of the FAT
+//   nsect : maximum number of FAT sectors to read in this call (0: to the end)
+//   left : if not NULL, receives the number of FAT entries still to be
+//          checked (0 when the count is complete)
+// Return if ok
+
+bool FatFsClass::scanFree( uint16_t nsect, uint32_t * left )
+{
+  DWORD nclst, nleft;
+
+  ffs_result = f_scanfree( "0:", nsect, & nclst, & nleft );
+  if( left != NULL )
+    * left = ffs_result == FR_OK ? nleft : 0;
+  return ffs_result == FR_OK;
+}
+#endif
+
+#if FF_USE_BATCH
+// Open a batch of updates, for instance before creating many small files
+// Until commitBatch() is called, closing a file or making, removing or
+//   renaming an entry does not write the FSINFO sector nor flush the card,
+//   and the modified directory and FAT sectors are kept in memory as long
+//   as the sector cache (FF_WIN_CACHE in ffconf.h) can hold them
+// Batches can be nested; only the outermost commitBatch() writes
+// If power is lost before commitBatch(), files created or modified in the
+//   batch can be missing or have their old size, and the clusters
+//   allocated to them are lost until the volume is checked
+// Return true if ok
+
+bool FatFsClass::beginBatch()
+{
+  ffs_result = f_batch( "0:", 1 );
+  return ffs_result == FR_OK;
+}
+
+// Write the updates deferred since beginBatch(), FAT sectors first,
+//   then update the FSINFO sector and flush the card
+// Return true if ok
+
+bool FatFsClass::commitBatch()
+{
+  ffs_result = f_batch( "0:", 0 );
+  return ffs_result == FR_OK;
+}
+#endif
+
 // Return last error value
 // See ff.h for a description of errors
 
@@ -166,6 +254,34 @@ uint8_t FatFsClass::error()
   return ffs_result;
 }
 
+#if FF_WIN_CACHE
+// Return statistics of the sector cache since the volume was mounted
+//   hits : number of sectors found in the cache
+//   misses : number of sectors read from the card
+//   writeBacks : number of dirty sectors written back from the cache
+// Use them to choose the value of FF_WIN_CACHE in ffconf.h
+
+void FatFsClass::cacheStats( uint32_t * hits, uint32_t * misses, uint32_t * writeBacks )
+{
+  * hits = ffs.wc_hit;
+  * misses = ffs.wc_miss;
+  * writeBacks = ffs.wc_wback;
+}
+#endif
+
+#if FF_PATH_CACHE
+// Return statistics of the path cache since the volume was mounted
+//   hits : number of path segments found in the cache
+//   misses : number of path segments looked up on the directory
+// Use them to choose the value of FF_PATH_CACHE in ffconf.h
+
+void FatFsClass::pathCacheStats( uint32_t * hits, uint32_t * misses )
+{
+  * hits = ffs.pc_hit;
+  * misses = ffs.pc_miss;
+}
+#endif
+
 // Make a directory
 //   dirPath : absolute name of new directory
 // Return true if ok
@@ -257,6 +373,33 @@ bool FatFsClass::getFileModTime( const char * path, uint16_t * pdate, uint16_t *
   return true;
 }
 
+#if FF_FS_RPATH
+// Change the current directory
+//   path : name of the new current directory
+// Names without a heading '/' given to the other functions are then
+//   relative to this directory
+// Return true if ok
+
+bool FatFsClass::chdir( const char * path )
+{
+  ffs_result = f_chdir( path );
+  return ffs_result == FR_OK;
+}
+#endif
+
+#if FF_FS_RPATH >= 2
+// Get the current directory
+//   buf : buffer to receive the absolute name of the current directory
+//   len : size of buf
+// Return true if ok
+
+bool FatFsClass::getcwd( char * buf, size_t len )
+{
+  ffs_result = f_getcwd( buf, len );
+  return ffs_result == FR_OK;
+}
+#endif
+
 /* ===========================================================
 
                     DirFs functions
@@ -264,7 +407,8 @@ bool FatFsClass::getFileModTime( const char * path, uint16_t * pdate, uint16_t *
    =========================================================== */
 
 // Open a directory
-//   dirPath : absolute name of directory
+//   dirPath : name of directory, relative to the current directory
+//             if it does not begin with '/'
 // Return true if ok
 
 bool DirFs::open( char * dirPath )
@@ -340,45 +484,283 @@ uint16_t DirFs::fileModTime()
    =========================================================== */
 
 // Open a file
-//   fileName : absolute name of the file to open
+//   fileName : name of the file to open, relative to the current directory
+//              if it does not begin with '/'
 //   mode : specifies the type of access and open method for the file
 //          (see ff.h for a description of possible values)
 // Return true if ok
    
 bool FileFs::open( char * fileName, uint8_t mode )
 {
+  resetState();
   ffs_result = f_open( & ffile, fileName, mode );
   return ffs_result == FR_OK;
 }
 
+#if FF_FS_RPATH
+// Open a file in an open directory
+//   dir : directory where the name is looked up
+//   fileName : name of the file relative to dir
+//   mode : same as open()
+// The parent directories of dir are not looked up again, so it is cheaper
+//   than open() with the absolute name for many files in a deep directory
+// Fails with FR_NO_PATH if the directory was removed after dir was opened
+//   (unless a new directory took its place; FF_FS_LOCK forbids the removal)
+// Return true if ok
+
+bool FileFs::openAt( DirFs & dir, const char * fileName, uint8_t mode )
+{
+  resetState();
+  ffs_result = f_openat( & ffile, & dir.dir, fileName, mode );
+  return ffs_result == FR_OK;
+}
+#endif
+
 // Close the file
+// If space was reserved by preallocate(), the part not written is released
 // Return true if ok
 
 bool FileFs::close()
 {
+  FRESULT res = FR_OK;
+
+  rpos = rlen = 0;
+#if FF_USE_FASTSEEK
+  if( rend != 0 )
+    rawEnd();
+#endif
+#if FF_USE_EXPAND
+  if( palloc && pend < f_size( & ffile ))
+  {
+    res = f_lseek( & ffile, pend );
+    if( res == FR_OK )
+      res = f_truncate( & ffile );
+  }
+  palloc = false;
+#endif
   ffs_result =  f_close( & ffile );
+  if( ffs_result == FR_OK )
+    ffs_result = res;
+  freeLinkMap();
+  return ffs_result == FR_OK;
+}
+
+// Write back cached data of the file and update its directory entry, so the
+//   file is consistent if the system goes down before close()
+// Return true if ok
+
+bool FileFs::sync()
+{
+  if( ! dropBuffer())
+    return false;
+  ffs_result = f_sync( & ffile );
+  return ffs_result == FR_OK;
+}
+
+#if FF_USE_EXPAND
+// Reserve space for the file, so writing it does not have to search for
+//   free clusters and link them on the FAT cluster after cluster
+//   size : number of bytes to reserve
+//   contiguous : if true, the space must be a contiguous block of clusters;
+//                if false, a fragmented chain is allocated when no block
+//                is large enough
+// The file must be empty and opened in write mode
+// The cluster chain is linked at once and the file size is set to size.
+//   Writes within this size take the clusters from a link map, so they
+//   don't touch the FAT until close() trims the file to the end of
+//   the data written. If the file is not closed (power loss), it keeps
+//   the reserved size
+// Return true if ok
+
+bool FileFs::preallocate( uint32_t size, bool contiguous )
+{
+  if( ! dropBuffer())
+    return false;
+  ffs_result = f_expand( & ffile, size, 1 );
+  if( ffs_result == FR_DENIED && ! contiguous &&
+      f_size( & ffile ) == 0 && ( ffile.flag & FA_WRITE ))
+  {
+    // no block large enough: expanding by a seek links a fragmented chain
+    ffs_result = f_lseek( & ffile, size );
+    if( ffs_result == FR_OK )
+      ffs_result = f_lseek( & ffile, 0 );
+  }
+  if( ffs_result != FR_OK )
+    return false;
+  palloc = true;
+  pend = 0;
+  freeLinkMap();
+  buildLinkMap();
+  return true;
+}
+#endif
+
+#if FF_USE_FASTSEEK
+// Get the range of sectors of a file made of one contiguous block of clusters
+//   bgnSector : first sector of the file
+//   endSector : sector after the last sector of the last cluster of the file
+// Return false if the file is empty or fragmented
+
+bool FileFs::contiguousRange( uint32_t * bgnSector, uint32_t * endSector )
+{
+  DWORD   tbl[ 4 ], * cltbl;
+  FATFS * fs;
+
+  // a table for one fragment is too small for a fragmented chain
+  cltbl = ffile.cltbl;
+  tbl[ 0 ] = 4;
+  ffile.cltbl = tbl;
+  ffs_result = f_lseek( & ffile, CREATE_LINKMAP );
+  ffile.cltbl = cltbl;
+  if( ffs_result == FR_NOT_ENOUGH_CORE || ( ffs_result == FR_OK && tbl[ 1 ] == 0 ))
+    ffs_result = FR_DENIED;
+  if( ffs_result != FR_OK )
+    return false;
+  fs = ffile.obj.fs;
+  * bgnSector = fs->database + (LBA_t) fs->csize * ( tbl[ 2 ] - 2 );
+  * endSector = * bgnSector + (LBA_t) fs->csize * tbl[ 1 ];
+  return true;
+}
+
+// Enter raw mode: sectors of a contiguous file (see preallocate()) are then
+//   written or read by rawWrite() and rawRead() straight from the caller
+//   buffer to the card, starting at the file pointer. Neither the FAT nor
+//   the directory are accessed until rawSync() or rawEnd()
+// The file pointer must be at a sector boundary
+// Other functions must not be used on the file until rawEnd()
+// Return true if ok
+
+bool FileFs::rawBegin()
+{
+  uint32_t bgn, end;
+
+  if( ! dropBuffer())
+    return false;
+  if( f_tell( & ffile ) % FF_MIN_SS != 0 )
+  {
+    ffs_result = FR_INVALID_PARAMETER;
+    return false;
+  }
+  ffs_result = f_sync( & ffile );   // write back the sector buffer
+  if( ffs_result != FR_OK || ! contiguousRange( & bgn, & end ))
+    return false;
+  rbase = bgn;
+  rend = end;
+  rsect = rbase + f_tell( & ffile ) / FF_MIN_SS;
+  return true;
+}
+
+// Write sectors in raw mode
+//   buf : pointer to the data to be written
+//   nsect : number of sectors to write
+// All sectors are given to the card in one multi-block request
+// Writing stops at the end of the last cluster of the file
+// Return number of sectors written
+
+uint32_t FileFs::rawWrite( const void * buf, uint32_t nsect )
+{
+  ffs_result = FR_DENIED;
+  if( rend == 0 || ! ( ffile.flag & FA_WRITE ))
+    return 0;
+  ffs_result = FR_OK;
+  if( nsect > rend - rsect )
+    nsect = rend - rsect;
+  if( nsect == 0 )
+    return 0;
+  if( disk_write( ffile.obj.fs->pdrv, (const BYTE *) buf, rsect, nsect ) != RES_OK )
+  {
+    ffs_result = FR_DISK_ERR;
+    return 0;
+  }
+  rsect += nsect;
+  // move the file pointer after the sectors and enlarge the file size,
+  //   without touching the FAT or the directory
+  ffs_result = f_rawadvance( & ffile, (FSIZE_t) ( rsect - rbase ) * FF_MIN_SS - f_tell( & ffile ), 1 );
+  return nsect;
+}
+
+// Read sectors in raw mode
+//   buf : pointer to buffer where to store read data
+//   nsect : number of sectors to read
+// Reading stops at the end of the last cluster of the file, not at the
+//   end of data
+// Return number of sectors read
+
+uint32_t FileFs::rawRead( void * buf, uint32_t nsect )
+{
+  ffs_result = FR_DENIED;
+  if( rend == 0 )
+    return 0;
+  ffs_result = FR_OK;
+  if( nsect > rend - rsect )
+    nsect = rend - rsect;
+  if( nsect == 0 )
+    return 0;
+  if( disk_read( ffile.obj.fs->pdrv, (BYTE *) buf, rsect, nsect ) != RES_OK )
+  {
+    ffs_result = FR_DISK_ERR;
+    return 0;
+  }
+  rsect += nsect;
+  // the file pointer stops at the end of data
+  ffs_result = f_rawadvance( & ffile, (FSIZE_t) ( rsect - rbase ) * FF_MIN_SS - f_tell( & ffile ), 0 );
+  return nsect;
+}
+
+// Checkpoint in raw mode: the directory entry is updated with the file size
+//   enlarged by the sectors written
+// Return true if ok
+
+bool FileFs::rawSync()
+{
+  ffs_result = FR_DENIED;
+  if( rend == 0 )
+    return false;
+#if FF_USE_EXPAND
+  if( palloc && f_tell( & ffile ) > pend )
+    pend = f_tell( & ffile );
+#endif
+  ffs_result = f_sync( & ffile );
   return ffs_result == FR_OK;
 }
 
+// Leave raw mode, making a last checkpoint
+// Return true if ok
+
+bool FileFs::rawEnd()
+{
+  bool ok = rawSync();
+
+  rend = 0;
+  return ok;
+}
+#endif
+
 // Writes data to the file
 //   buf : pointer to the data to be written
 //   lbuf : number of bytes to write
 // Return number of bytes written
+// The whole buffer is given to f_write, so sector aligned parts of it
+//   are written directly to the card with multi-sector requests
 
 uint32_t FileFs::write( void * buf, uint32_t lbuf )
 {
   uint32_t lb, nwrt0, nwrt = 0;
   
-  ffs_result = FR_OK;
+  if( ! startWrite( lbuf ))
+    return 0;
   while( nwrt < lbuf && ffs_result == FR_OK )
   {
     nwrt0 = 0;
     lb = lbuf - nwrt;
-    if( lb > FF_MIN_SS )
-      lb = FF_MIN_SS;
-    ffs_result = f_write( & ffile, ( buf + nwrt ), lb, (UINT*) & nwrt0 );
+    if( lb > FFS_MAX_CHUNK )
+      lb = FFS_MAX_CHUNK;
+    ffs_result = f_write( & ffile, (uint8_t *) buf + nwrt, lb, (UINT*) & nwrt0 );
+    if( nwrt0 == 0 )
+      break;
     nwrt += nwrt0;
   }
+  endWrite();
   return nwrt;
 }
 
@@ -388,7 +770,13 @@ uint32_t FileFs::write( void * buf, uint32_t lbuf )
 
 int FileFs::writeString( char * str )
 {
-  return f_puts( str, & ffile );
+  int n;
+
+  if( ! startWrite( strlen( str )))
+    return -1;
+  n = f_puts( str, & ffile );
+  endWrite();
+  return n;
 }
 
 // Write a character to the file
@@ -397,48 +785,271 @@ int FileFs::writeString( char * str )
 
 bool FileFs::writeChar( char car )
 {
-  return f_putc( car, & ffile ) == 1;
+  int n;
+
+  if( ! startWrite( 1 ))
+    return false;
+  n = f_putc( car, & ffile );
+  endWrite();
+  return n == 1;
 }
 
 // Read data from the file
 //   buf : pointer to buffer where to store read data
 //   lbuf : number of bytes to read
 // Return number of read bytes
+// The whole buffer is given to f_read, so sector aligned parts of it
+//   are read directly from the card with multi-sector requests
+// If a read-ahead buffer was set by setReadAhead(), reads smaller than it
+//   are served from it
 
 uint32_t FileFs::read( void * buf, uint32_t lbuf )
 {
   uint32_t lb, nrd0, nrd;
   
-  nrd = 0;
+  // first, take what is left in the read-ahead buffer
+  nrd = rlen - rpos;
+  if( nrd > lbuf )
+    nrd = lbuf;
+  memcpy( buf, rptr + rpos, nrd );
+  rpos += nrd;
+  rhits += nrd;
+  ffs_result = FR_OK;
+  while( rptr != rbuf && nrd < lbuf && lbuf - nrd < rsize && fillBuffer())
+  {
+    lb = rlen - rpos;
+    if( lb > lbuf - nrd )
+      lb = lbuf - nrd;
+    memcpy( (uint8_t *) buf + nrd, rptr + rpos, lb );
+    rpos += lb;
+    rhits += lb;
+    nrd += lb;
+  }
+  if( nrd == lbuf || ffs_result != FR_OK )
+    return nrd;
+  // the buffer is empty and the rest bypasses it: its last byte is no
+  //   longer the one before the file pointer, so ungetChar() must fail
+  rpos = rlen = 0;
   do
   {
     nrd0 = 0;
     lb = lbuf - nrd;
-    if( lb > FF_MIN_SS )
-      lb = FF_MIN_SS;
-    ffs_result = f_read( & ffile, ( buf + nrd ), lb, (UINT*) & nrd0 );
+    if( lb > FFS_MAX_CHUNK )
+      lb = FFS_MAX_CHUNK;
+    ffs_result = f_read( & ffile, (uint8_t *) buf + nrd, lb, (UINT*) & nrd0 );
     nrd += nrd0;
   }
   while( nrd0 > 0 && nrd < lbuf && ffs_result == FR_OK );
   return nrd;
 }
 
+// Set the size of the read-ahead buffer, allocated on the heap
+//   nsect : size in sectors, 0 to go back to the small buffer
+//           of FFS_READ_BUFFER_SIZE bytes
+// Sequential reads then get their sectors with multi-block reads of up
+//   to nsect sectors, across clusters. The amount read ahead starts with
+//   one sector after a seek and grows as long as reading goes on
+// Return true if ok
+
+bool FileFs::setReadAhead( uint16_t nsect )
+{
+  uint8_t * p = rbuf;
+  uint16_t  size = FFS_READ_BUFFER_SIZE;
+
+  if( ! dropBuffer())
+    return false;
+  if( nsect > 0 )
+  {
+    ffs_result = FR_INVALID_PARAMETER;
+    if( nsect > ( 0xFFFF - 1 ) / FF_MIN_SS )
+      return false;
+    // one more byte for the one kept by fillBuffer()
+    size = nsect * FF_MIN_SS + 1;
+    ffs_result = FR_NOT_ENOUGH_CORE;
+    if( ( p = (uint8_t *) malloc( size )) == NULL )
+      return false;
+    ffs_result = FR_OK;
+  }
+  if( rptr != rbuf )
+    free( rptr );
+  rptr = p;
+  rsize = size;
+  resetReadAhead();
+  rhits = rfills = 0;
+  return true;
+}
+
+// Get statistics of the read-ahead buffer, since the file was opened
+//   or setReadAhead() was called
+//   hits : number of bytes read from the buffer
+//   fills : number of refills, each one a request to FatFs
+
+void FileFs::readAheadStats( uint32_t * hits, uint32_t * fills )
+{
+  * hits = rhits;
+  * fills = rfills;
+}
+
+#if FF_USE_FORWARD
+// Send data of the file to a stream without copying it into a user buffer
+//   func : streaming function. It is called with ( NULL, 0 ) to know if the
+//          stream can take data (return 0 if busy) and with ( data, n )
+//          to send n bytes (return the number of bytes taken, 1 at least)
+//   len : maximum number of bytes to send
+// Each call of func gets a slice of one sector at most, straight from the
+//   sector buffer of the file
+// Sending stops when the stream goes busy; call again to go on
+// Return number of bytes sent
+
+uint32_t FileFs::forward( UINT (* func)( const BYTE *, UINT ), uint32_t len )
+{
+  uint32_t lb, nfwd0, nfwd = 0;
+
+  if( ! dropBuffer())
+    return 0;
+  do
+  {
+    nfwd0 = 0;
+    lb = len - nfwd;
+    if( lb > FFS_MAX_CHUNK )
+      lb = FFS_MAX_CHUNK;
+    ffs_result = f_forward( & ffile, func, lb, (UINT*) & nfwd0 );
+    nfwd += nfwd0;
+  }
+  while( nfwd0 == lb && nfwd < len && ffs_result == FR_OK );
+  return nfwd;
+}
+
+// Same as above, but the parts of the file on sector boundaries are read
+//   into buf with multi-sector requests, as many contiguous sectors as fit
+//   in lbuf bytes (across contiguous clusters), and passed to func at once
+//   buf : buffer to read the sectors into (a DMA capable buffer
+//         if the card driver uses DMA)
+//   lbuf : size of buf; must be one sector (512 bytes) at least
+
+uint32_t FileFs::forward( UINT (* func)( const BYTE *, UINT ), void * buf, uint32_t lbuf, uint32_t len )
+{
+  uint32_t lb, nfwd0, nfwd = 0;
+
+  if( ! dropBuffer())
+    return 0;
+  if( lbuf > FFS_MAX_CHUNK )
+    lbuf = FFS_MAX_CHUNK;
+  do
+  {
+    nfwd0 = 0;
+    lb = len - nfwd;
+    if( lb > FFS_MAX_CHUNK )
+      lb = FFS_MAX_CHUNK;
+    ffs_result = f_forwardrun( & ffile, func, (BYTE *) buf, lbuf, lb, (UINT*) & nfwd0 );
+    nfwd += nfwd0;
+  }
+  while( nfwd0 == lb && nfwd < len && ffs_result == FR_OK );
+  return nfwd;
+}
+#endif
+
 // Read a string from the file
 //   str : read buffer
 //   len : size of read buffer
+// Reading stops after a new line character or when buffer is full
+// End of line characters are removed from the string
 // Return number of characters read or -1 if an error occurs
+//   or end of file is reached
 
 int16_t FileFs::readString( char * str, int len )
 {
-  str = f_gets( str, len, & ffile );
-  if( str == NULL )
+  int16_t lstr = 0;
+  int     c = 0;
+  
+  while( lstr < len - 1 && ( c = getByte()) >= 0 )
+  {
+    str[ lstr ++ ] = c;
+    if( c == '\n' )
+      break;
+  }
+  if( len > 0 )
+    str[ lstr ] = 0;
+  if( lstr == 0 && c < 0 )
     return -1;
-  uint16_t lstr = strlen( str ) - 1;
-  while( lstr > 0 && ( str[ lstr ] == '\n' || str[ lstr ] == '\r' ))
-    str[ lstr -- ] = 0;
+  while( lstr > 0 && ( str[ lstr - 1 ] == '\n' || str[ lstr - 1 ] == '\r' ))
+    str[ -- lstr ] = 0;
   return lstr;
 }
 
+// Read next line of the file, without copying it when possible
+//   buf : buffer where to store the line when it spans two sectors
+//   len : size of buf (at least 1)
+//   pline : receive a pointer to the first character of the line
+// When the line is entirely in one sector, *pline points directly
+//   to the sector buffer of the file. Else the line is copied to buf.
+//   If it doesn't fit, the end of the line is returned by next call.
+// The line is NOT null terminated and end of line characters are
+//   not counted. *pline is valid until next operation on the file.
+//   With FF_FS_TINY the sector buffer is shared by the volume, so *pline
+//   is valid only until next operation on any file or directory of it.
+// Return length of the line or -1 if end of file is reached
+//   or an error occurs
+
+int16_t FileFs::readLine( char * buf, int len, const char ** pline )
+{
+  uint8_t  car, * sbuf, * start, * eol;
+  uint32_t nrd, left, ofs, take;
+  int16_t  lline = 0;
+  bool     eof = true;
+
+  if( ! dropBuffer())
+    return -1;
+  * pline = buf;
+  while( lline < len )
+  {
+    // read first byte of the segment. That load its sector in the sector buffer
+    ffs_result = f_read( & ffile, & car, 1, (UINT*) & nrd );
+    if( nrd != 1 )
+      break;
+    eof = false;
+#if FF_FS_TINY
+    sbuf = ffile.obj.fs->win;
+#else
+    sbuf = ffile.buf;
+#endif
+    ofs = ( f_tell( & ffile ) - 1 ) % FF_MIN_SS;
+    start = sbuf + ofs;
+    left = f_size( & ffile ) - f_tell( & ffile ) + 1;
+    take = FF_MIN_SS - ofs;
+    if( take > left )
+      take = left;
+    eol = (uint8_t *) memchr( start, '\n', take );
+    if( eol != NULL )
+      take = eol - start + 1;
+    if( lline == 0 && eol != NULL )
+    {
+      // whole line is in the sector: return a pointer to it
+      * pline = (const char *) start;
+      lline = take;
+    }
+    else
+    {
+      if( take > (uint32_t) ( len - lline ))
+        take = len - lline;
+      memcpy( buf + lline, start, take );
+      lline += take;
+    }
+    // consume the rest of the segment. The position stays in the sector
+    //   of the buffer, so f_lseek() does not access the card
+    ffs_result = f_lseek( & ffile, f_tell( & ffile ) + take - 1 );
+    if( ffs_result != FR_OK )
+      break;
+    if( eol != NULL && ( * pline )[ lline - 1 ] == '\n' )
+      break;
+  }
+  if( eof )
+    return -1;
+  while( lline > 0 && (( * pline )[ lline - 1 ] == '\n' || ( * pline )[ lline - 1 ] == '\r' ))
+    lline --;
+  return lline;
+}
+
 // Read a character from the file
 // Return read char or -1 if an error occurs
 // In case of -1 returned, must call FatFs.error() to know
@@ -446,11 +1057,30 @@ int16_t FileFs::readString( char * str, int len )
 
 char FileFs::readChar()
 {
-  char     car;
-  uint32_t nrd;
-  
-  ffs_result = f_read( & ffile, & car, 1, (UINT*) & nrd );
-  return nrd == 1 ? car : -1;
+  return getByte();
+}
+
+// Return next character of the file without consuming it
+//   or -1 if end of file is reached or an error occurs
+
+int FileFs::peekChar()
+{
+  if( rpos >= rlen && ! fillBuffer())
+    return -1;
+  return rptr[ rpos ];
+}
+
+// Put back in the file the last character read by readChar(),
+//   readInt(), readHex() or readString()
+// Only one character is guaranteed to be put back after a read
+// Return true if ok
+
+bool FileFs::ungetChar()
+{
+  if( rpos == 0 )
+    return false;
+  rpos --;
+  return true;
 }
 
 // Read next literal integer from file
@@ -460,15 +1090,15 @@ char FileFs::readChar()
 uint16_t FileFs::readInt()
 {
   uint16_t i = 0;
-  char c;
+  int c;
   // skip characters they are not integer
   do
-    c = readChar();
-  while( c != -1 && ! isdigit( c ));
-  while( isdigit( c ))
+    c = getByte();
+  while( c >= 0 && ! isdigit( c ));
+  while( c >= 0 && isdigit( c ))
   {
     i = 10 * i + c - '0';
-    c = readChar();
+    c = getByte();
   }
   return i;
 }
@@ -480,12 +1110,12 @@ uint16_t FileFs::readInt()
 uint16_t FileFs::readHex()
 {
   uint16_t i = 0;
-  char c;
+  int c;
   // skip characters they are not hexadecimal
   do
-    c = readChar();
-  while( c != -1 && ! isxdigit( c ));
-  while( isxdigit( c ))
+    c = getByte();
+  while( c >= 0 && ! isxdigit( c ));
+  while( c >= 0 && isxdigit( c ))
   {
     i = 16 * i + c;
     if( isdigit( c ))
@@ -493,21 +1123,128 @@ uint16_t FileFs::readHex()
     else
     {
       i += 10;
-      if( c < 'F' )
+      if( c <= 'F' )
         i -= 'A';
       else
         i -= 'a';
     }
-    c = readChar();
+    c = getByte();
   }
   return i;
 }
 
+// Return next byte from the read-ahead buffer, refilling it if needed
+// Return -1 at end of file or if an error occurs
+
+int FileFs::getByte()
+{
+  if( rpos >= rlen && ! fillBuffer())
+    return -1;
+  rhits ++;
+  return rptr[ rpos ++ ];
+}
+
+// Refill the read-ahead buffer
+// A refill ends at a sector boundary, so it never reads a sector only
+//   partly used. The last byte of previous content is kept
+//   in front of the buffer to allow ungetChar()
+// While reading is sequential, the amount read ahead doubles at each
+//   refill, up to the size of the buffer
+// Return false at end of file or if an error occurs
+
+bool FileFs::fillBuffer()
+{
+  uint32_t lb, pos, end, nrd = 0;
+  uint16_t keep = 0;
+
+  if( rlen > 0 && rsize > 1 )
+  {
+    rptr[ 0 ] = rptr[ rlen - 1 ];
+    keep = 1;
+  }
+  pos = f_tell( & ffile );
+  end = pos + ( rwin < rsize - keep ? rwin : rsize - keep );
+  if( end / FF_MIN_SS != pos / FF_MIN_SS )
+    end -= end % FF_MIN_SS;
+  lb = end - pos;
+  ffs_result = f_read( & ffile, rptr + keep, lb, (UINT*) & nrd );
+  rfills ++;
+  if( rwin < rsize )
+    rwin = 2 * (uint32_t) rwin < rsize ? 2 * rwin : rsize;
+  rpos = keep;
+  rlen = keep + nrd;
+  return nrd > 0;
+}
+
+// Clear what is kept about the previously open file
+
+void FileFs::resetState()
+{
+  rpos = rlen = 0;
+  rhits = rfills = 0;
+  resetReadAhead();
+  freeLinkMap();
+  palloc = false;
+  rend = 0;
+}
+
+// Set the read-ahead window back to its smallest size after a seek
+
+void FileFs::resetReadAhead()
+{
+  rwin = rsize > FF_MIN_SS ? FF_MIN_SS : rsize;
+}
+
+// Discard content of the read-ahead buffer, moving back the file pointer
+//   to the position of the next character not yet consumed
+// Must be called before any operation that use the file pointer
+// Return true if ok
+
+bool FileFs::dropBuffer()
+{
+  ffs_result = FR_OK;
+  if( rpos < rlen )
+  {
+    ffs_result = f_lseek( & ffile, f_tell( & ffile ) - ( rlen - rpos ));
+    resetReadAhead();
+  }
+  rpos = rlen = 0;
+  return ffs_result == FR_OK;
+}
+
+// Prepare writing len bytes at the file pointer
+// Return true if ok
+
+bool FileFs::startWrite( uint32_t len )
+{
+  if( ! dropBuffer())
+    return false;
+#if FF_USE_EXPAND
+  // the link map of a preallocated file only covers the reserved space
+  if( palloc && lmstat == 1 && f_tell( & ffile ) + len > f_size( & ffile ))
+  {
+    freeLinkMap();
+    lmstat = 2;
+  }
+#endif
+  return true;
+}
+
+// Keep track of the end of data written in the reserved space
+
+void FileFs::endWrite()
+{
+#if FF_USE_EXPAND
+  if( palloc && f_tell( & ffile ) > pend )
+    pend = f_tell( & ffile );
+#endif
+}
+
 // Return the current read/write pointer of a file
 
 uint32_t FileFs::curPosition()
 {
-  return f_tell( & ffile );
+  return f_tell( & ffile ) - ( rlen - rpos );
 }
 
 // Moves the file read/write pointer
@@ -515,13 +1252,80 @@ uint32_t FileFs::curPosition()
 // Return if ok
 // In case cur is greater than file size and file is opened in write mode,
 //   size of file is expanded
+// On the first call for a file opened in read only mode, a cluster link map
+//   is built so next seeks don't have to walk the FAT
 
 bool FileFs::seekSet( uint32_t cur )
 {
+  rpos = rlen = 0;
+  resetReadAhead();
+#if FF_USE_EXPAND
+  if( palloc && cur > f_size( & ffile ))
+  {
+    // the file is expanded past the reserved space
+    freeLinkMap();
+    lmstat = 2;
+    pend = cur;
+  }
+#endif
+  if( lmstat == 0 )
+    buildLinkMap();
   ffs_result = f_lseek( & ffile, cur );
   return ffs_result == FR_OK;
 }
 
+// Build the cluster link map table of the file, so seeking and reading
+//   get the clusters from the table instead of following the chain on the FAT
+// The table is allocated on the heap and enlarged as needed
+// Only files opened in read only mode or preallocated can use a link map,
+//   because FatFs can't expand a file that use it
+// Return true if the table is in use. If not, seeking falls back to
+//   the normal way
+
+bool FileFs::buildLinkMap()
+{
+#if FF_USE_FASTSEEK
+  uint32_t lmsize = FFS_LINKMAP_SIZE;
+  FRESULT  res;
+
+  lmstat = 2;
+  if( ffile.obj.fs == NULL || (( ffile.flag & FA_WRITE ) && ! palloc ))
+    return false;
+  while( ( lmap = (DWORD *) malloc( lmsize * sizeof( DWORD ))) != NULL )
+  {
+    lmap[ 0 ] = lmsize;
+    ffile.cltbl = lmap;
+    res = f_lseek( & ffile, CREATE_LINKMAP );
+    if( res == FR_OK )
+    {
+      lmstat = 1;
+      return true;
+    }
+    // table is too small: lmap[ 0 ] now holds the required size
+    ffile.cltbl = NULL;
+    lmsize = lmap[ 0 ];
+    free( lmap );
+    lmap = NULL;
+    if( res != FR_NOT_ENOUGH_CORE )
+      break;
+  }
+#endif
+  return false;
+}
+
+// Release the cluster link map table
+
+void FileFs::freeLinkMap()
+{
+#if FF_USE_FASTSEEK
+  if( lmap != NULL && ffile.cltbl == lmap )
+    ffile.cltbl = NULL;
+#endif
+  free( lmap );
+  lmap = NULL;
+  lmstat = 0;
+}
+
 // Return size of file
 
 uint32_t FileFs::fileSize()
@@ -529,4 +1333,221 @@ uint32_t FileFs::fileSize()
   return f_size( & ffile );
 }
 
+/* ===========================================================
+
+                    WriterFs functions
+
+   =========================================================== */
+
+// Start the writer
+//   pfile : file opened in write mode, where data is written
+//   nbuffers : number of buffers of the ring (2 at least)
+//   nsect : size of each buffer, in sectors
+// A full buffer is written with a multi-block request. If the file pointer
+//   is at a sector boundary (and the file preallocated, see
+//   FileFs::preallocate()), f_write sends it straight from the buffer
+// Return true if ok
+
+bool WriterFs::begin( FileFs * pfile, uint8_t nbuffers, uint16_t nsect )
+{
+  end();
+  ffs_result = FR_INVALID_PARAMETER;
+  if( pfile == NULL || nbuffers < 2 || nsect == 0 || nsect > 0xFFFF / FF_MIN_SS )
+    return false;
+  ffs_result = FR_NOT_ENOUGH_CORE;
+  nbuf = nbuffers;
+  bsize = nsect * FF_MIN_SS;
+  bufs = (uint8_t *) malloc( (uint32_t) nbuf * bsize );
+  blen = (uint16_t *) malloc( nbuf * sizeof( uint16_t ));
+  if( bufs == NULL || blen == NULL )
+  {
+    end();
+    return false;
+  }
+  file = pfile;
+  widx = ridx = 0;
+  wpos = 0;
+  wcnt = rcnt = 0;
+  nlost = maxus = 0;
+  hwm = 0;
+  ffs_result = FR_OK;
+  return true;
+}
+
+// Flush the writer and release the buffers
+// The file is not closed
+// Return true if ok
+
+bool WriterFs::end()
+{
+  bool ok = true;
+
+  if( file != NULL )
+    ok = flush();
+  free( bufs );
+  free( blen );
+  bufs = NULL;
+  blen = NULL;
+  file = NULL;
+  return ok;
+}
+
+// Put data in the ring of buffers. The card is not accessed, so this can be
+//   called from an interrupt routine (one producer only)
+//   data : pointer to the data
+//   len : number of bytes
+// When all the buffers are full, the data left is dropped and counted
+//   as lost (see stats())
+// Return number of bytes taken
+
+uint32_t WriterFs::put( const void * data, uint32_t len )
+{
+  uint32_t n, nput = 0;
+  uint8_t  full;
+
+  if( file == NULL )
+    return 0;
+  while( nput < len )
+  {
+    full = wcnt - rcnt;
+    if( full >= nbuf )
+    {
+      nlost += len - nput;
+      break;
+    }
+    n = bsize - wpos;
+    if( n > len - nput )
+      n = len - nput;
+    memcpy( bufs + (uint32_t) widx * bsize + wpos, (const uint8_t *) data + nput, n );
+    wpos += n;
+    nput += n;
+    if( wpos == bsize )
+    {
+      // hand the buffer over to poll(). The barrier makes the data and
+      //   the length visible before the count that publishes them
+      blen[ widx ] = bsize;
+      wpos = 0;
+      if( ++ widx == nbuf )
+        widx = 0;
+      __sync_synchronize();
+      wcnt ++;
+      if( ++ full > hwm )
+        hwm = full;
+    }
+  }
+  return nput;
+}
+
+// Write full buffers to the file
+// Return at once if there is nothing to write or if the card is still busy
+//   with a previous write, so the caller is never blocked by the card
+//   programming time. Consecutive full buffers of the ring are written
+//   with a single request
+// On ESP8266 the card driver can't tell if the card is busy, so poll()
+//   waits for the card there instead of returning at once
+// Must be called often enough from the main loop, never from an interrupt
+// Return true if ok
+
+bool WriterFs::poll()
+{
+  uint32_t t, n, nw;
+  uint8_t  k, full;
+
+  ffs_result = FR_INVALID_OBJECT;
+  if( file == NULL )
+    return false;
+  ffs_result = FR_OK;
+  full = wcnt - rcnt;
+  if( full == 0 )
+    return true;
+  // read the buffers published by put() only after their count
+  __sync_synchronize();
+#ifndef ESP8266
+#if FF_FS_REENTRANT
+  // the card may be in use by another task: ask it under the volume lock
+  if( ! ff_req_grant( file->ffile.obj.fs->sobj ))
+  {
+    ffs_result = FR_TIMEOUT;
+    return false;
+  }
+  bool busy = card.isBusy();
+  ff_rel_grant( file->ffile.obj.fs->sobj );
+  if( busy )
+    return true;
+#else
+  if( card.isBusy())
+    return true;
+#endif
+#endif
+  n = blen[ ridx ];
+  for( k = 1; k < full && ridx + k < nbuf && n % bsize == 0; k ++ )
+    n += blen[ ridx + k ];
+  t = micros();
+  nw = file->write( bufs + (uint32_t) ridx * bsize, n );
+  t = micros() - t;
+  if( t > maxus )
+    maxus = t;
+  if( nw != n )
+  {
+    if( ffs_result == FR_OK )
+      ffs_result = FR_DENIED;
+    return false;
+  }
+  ridx += k;
+  if( ridx == nbuf )
+    ridx = 0;
+  // the buffers are handed back to put() once they have been written
+  __sync_synchronize();
+  rcnt += k;
+  return true;
+}
+
+// Write everything put so far, even a buffer partly filled, and sync
+//   the file. Wait for the card if needed
+// The producer may go on meanwhile
+// Return true if ok
+
+bool WriterFs::flush()
+{
+  uint8_t left, cnt;
+
+  ffs_result = FR_INVALID_OBJECT;
+  if( file == NULL )
+    return false;
+  noInterrupts();
+  if( wpos > 0 )
+  {
+    blen[ widx ] = wpos;
+    wpos = 0;
+    if( ++ widx == nbuf )
+      widx = 0;
+    __sync_synchronize();
+    wcnt ++;
+  }
+  left = wcnt - rcnt;
+  interrupts();
+  // poll() may also write buffers filled after this point
+  while( left > 0 )
+  {
+    cnt = rcnt;
+    if( ! poll())
+      return false;
+    cnt = rcnt - cnt;
+    left = cnt < left ? left - cnt : 0;
+  }
+  return file->sync();
+}
+
+// Get statistics of the writer
+//   lost : number of bytes dropped because all buffers were full
+//   highWater : highest number of full buffers waiting to be written
+//   maxWrite : longest time taken by a write to the file, in microseconds
+
+void WriterFs::stats( uint32_t * lost, uint8_t * highWater, uint32_t * maxWrite )
+{
+  * lost = nlost;
+  * highWater = hwm;
+  * maxWrite = maxus;
+}
+
 FatFsClass FatFs;
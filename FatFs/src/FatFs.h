@@ -34,6 +34,25 @@
 #include "ff.h"
 #include "diskio.h"
 
+// Size of read-ahead buffer of each FileFs object used by readChar(),
+//   readInt(), readHex() and readString(). Must be 1 at least
+// It is kept small on AVR, where RAM is scarce. setReadAhead() can
+//   give a larger buffer to a file that is read a character at a time
+#ifndef FFS_READ_BUFFER_SIZE
+  #if defined(__AVR__)
+    #define FFS_READ_BUFFER_SIZE 16
+  #else
+    #define FFS_READ_BUFFER_SIZE 64
+  #endif
+#endif
+
+// Initial number of items of the cluster link map table that FileFs builds
+//   to seek into files opened in read only mode (see FileFs::seekSet())
+// The table is enlarged if the file is more fragmented
+#ifndef FFS_LINKMAP_SIZE
+  #define FFS_LINKMAP_SIZE 32
+#endif
+
 class FatFsClass
 {
 public:
@@ -46,7 +65,20 @@ public:
 #endif
   int32_t  capacity();
   int32_t  free();
+#if FF_USE_FREESCAN
+  bool     scanFree( uint16_t nsect, uint32_t * left = NULL );
+#endif
+#if FF_USE_BATCH
+  bool     beginBatch();
+  bool     commitBatch();
+#endif
   uint8_t  error();
+#if FF_WIN_CACHE
+  void     cacheStats( uint32_t * hits, uint32_t * misses, uint32_t * writeBacks );
+#endif
+#if FF_PATH_CACHE
+  void     pathCacheStats( uint32_t * hits, uint32_t * misses );
+#endif
   
   bool     mkdir( const char * path );
   bool     rmdir( const char * path );
@@ -57,6 +89,12 @@ public:
   bool     timeStamp( const char * path, uint16_t year, uint8_t month, uint8_t day,
                       uint8_t hour, uint8_t minute, uint8_t second );
   bool     getFileModTime( const char * path, uint16_t * pdate, uint16_t * ptime );
+#if FF_FS_RPATH
+  bool     chdir( const char * path );
+#endif
+#if FF_FS_RPATH >= 2
+  bool     getcwd( char * buf, size_t len );
+#endif
 
 private:
   FATFS    ffs;
@@ -88,23 +126,52 @@ public:
 private:
   FILINFO  finfo;
   DIR      dir;
+
+  friend class FileFs;
 };
 
 class FileFs
 {
 public:
-  FileFs() {};
+  FileFs() : rptr( rbuf ), rsize( FFS_READ_BUFFER_SIZE ), rwin( FFS_READ_BUFFER_SIZE ),
+             rpos( 0 ), rlen( 0 ), rhits( 0 ), rfills( 0 ),
+             lmap( NULL ), lmstat( 0 ), palloc( false ), pend( 0 ), rend( 0 ) {};
+  ~FileFs() { freeLinkMap(); if( rptr != rbuf ) free( rptr ); };
   
   bool     open( char * fileName, uint8_t mode = FA_OPEN_EXISTING );
+#if FF_FS_RPATH
+  bool     openAt( DirFs & dir, const char * fileName, uint8_t mode = FA_OPEN_EXISTING );
+#endif
   bool     close();
+  bool     sync();
+#if FF_USE_EXPAND
+  bool     preallocate( uint32_t size, bool contiguous = true );
+#endif
+#if FF_USE_FASTSEEK
+  bool     contiguousRange( uint32_t * bgnSector, uint32_t * endSector );
+  bool     rawBegin();
+  uint32_t rawWrite( const void * buf, uint32_t nsect );
+  uint32_t rawRead( void * buf, uint32_t nsect );
+  bool     rawSync();
+  bool     rawEnd();
+#endif
   
   uint32_t write( void * buf, uint32_t lbuf );
   int      writeString( char * str );
   bool     writeChar( char car );
   
   uint32_t read( void * buf, uint32_t lbuf );
+  bool     setReadAhead( uint16_t nsect );
+  void     readAheadStats( uint32_t * hits, uint32_t * fills );
+#if FF_USE_FORWARD
+  uint32_t forward( UINT (* func)( const BYTE *, UINT ), uint32_t len );
+  uint32_t forward( UINT (* func)( const BYTE *, UINT ), void * buf, uint32_t lbuf, uint32_t len );
+#endif
   int16_t  readString( char * buf, int len );
+  int16_t  readLine( char * buf, int len, const char ** pline );
   char     readChar();
+  int      peekChar();
+  bool     ungetChar();
   uint16_t readInt();
   uint16_t readHex();
 
@@ -115,6 +182,75 @@ public:
   
 private:
   FIL      ffile;
+  uint8_t  rbuf[ FFS_READ_BUFFER_SIZE ]; // read-ahead buffer
+  uint8_t * rptr;                        // read-ahead buffer in use: rbuf or one set by setReadAhead()
+  uint16_t rsize;                        // size of the read-ahead buffer in use
+  uint16_t rwin;                         // number of bytes to read ahead at next refill
+  uint16_t rpos;                         // index of next byte to read in read-ahead buffer
+  uint16_t rlen;                         // number of valid bytes in read-ahead buffer
+  uint32_t rhits;                        // number of bytes taken from read-ahead buffer
+  uint32_t rfills;                       // number of refills of read-ahead buffer
+
+  DWORD *  lmap;                         // cluster link map table
+  uint8_t  lmstat;                       // 0: link map not built yet, 1: built, 2: not available
+  bool     palloc;                       // true if space was reserved by preallocate()
+  uint32_t pend;                         // end of data written in the reserved space
+
+  LBA_t    rsect;                        // next sector to write or read in raw mode
+  LBA_t    rbase;                        // first sector of the file in raw mode
+  LBA_t    rend;                         // end of the file sectors, 0 if not in raw mode
+
+  int      getByte();
+  bool     fillBuffer();
+  void     resetState();
+  void     resetReadAhead();
+  bool     dropBuffer();
+  bool     startWrite( uint32_t len );
+  void     endWrite();
+  bool     buildLinkMap();
+  void     freeLinkMap();
+
+  friend class WriterFs;
+};
+
+// Writer that decouples a producer (for example a sampling interrupt) from
+//   the card: data is put in a ring of buffers without any card access,
+//   and full buffers are written to the file by poll(), called from
+//   the main loop
+
+class WriterFs
+{
+public:
+  WriterFs() : file( NULL ), bufs( NULL ), blen( NULL ) {};
+  ~WriterFs() { end(); };
+
+  bool     begin( FileFs * pfile, uint8_t nbuffers = 2, uint16_t nsect = 8 );
+  bool     end();
+
+  uint32_t put( const void * data, uint32_t len );
+  bool     poll();
+  bool     flush();
+
+  void     stats( uint32_t * lost, uint8_t * highWater, uint32_t * maxWrite );
+
+private:
+  FileFs *  file;
+  uint8_t * bufs;                        // nbuf buffers of bsize bytes
+  uint16_t * blen;                       // number of bytes in each buffer
+  uint8_t   nbuf;
+  uint16_t  bsize;
+
+  // owned by the producer
+  uint8_t   widx;                        // buffer being filled
+  uint16_t  wpos;                        // number of bytes in it
+  volatile uint8_t wcnt;                 // number of buffers filled (wraps)
+  uint32_t  nlost;                       // number of bytes not taken
+  uint8_t   hwm;                         // highest number of full buffers
+
+  // owned by the consumer
+  uint8_t   ridx;                        // next buffer to write
+  volatile uint8_t rcnt;                 // number of buffers written (wraps)
+  uint32_t  maxus;                       // longest write in microseconds
 };
 
 // Return true if char c is allowed in a long file name
@@ -19,6 +19,7 @@
 /----------------------------------------------------------------------------*/
 
 
+#include <string.h>		/* memcpy() for word-wide access to the window */
 #include "ff.h"			/* Declarations of FatFs API */
 #include "diskio.h"		/* Declarations of device I/O functions */
 
@@ -50,6 +51,7 @@
 #define IsSurrogate(c)	((c) >= 0xD800 && (c) <= 0xDFFF)
 #define IsSurrogateH(c)	((c) >= 0xD800 && (c) <= 0xDBFF)
 #define IsSurrogateL(c)	((c) >= 0xDC00 && (c) <= 0xDFFF)
+#define WTOUPPER(c)		((c) < 0x80 ? (IsLower(c) ? (DWORD)((c) - 0x20) : (DWORD)(c)) : ff_wtoupper(c))	/* Up-case conversion with inline ASCII path */
 
 
 /* Additional file access control and file status flags for internal use */
@@ -190,6 +192,7 @@
 #define FSI_StrucSig		484		/* FAT32 FSI: Structure signature (DWORD) */
 #define FSI_Free_Count		488		/* FAT32 FSI: Number of free clusters (DWORD) */
 #define FSI_Nxt_Free		492		/* FAT32 FSI: Last allocated cluster (DWORD) */
+#define FSI_Reserved2		496		/* FAT32 FSI: Reserved (12-byte) */
 
 #define MBR_Table			446		/* MBR: Offset of partition table in the MBR */
 #define SZ_PTE				16		/* MBR: Size of a partition table entry */
@@ -273,6 +276,27 @@
 #endif
 
 
+/* Free cluster bitmap */
+#if FF_FAT_BITMAP
+#if FF_FAT_BITMAP < 4
+#error Wrong FF_FAT_BITMAP setting
+#endif
+#if defined(__GNUC__)
+#define CTZ32(w)	((UINT)__builtin_ctzl(w))	/* Number of trailing zero bits of a non-zero DWORD */
+#endif
+#endif
+
+
+/* Directory index */
+#if FF_DIR_INDEX
+#if FF_DIR_INDEX < 16 || !FF_USE_LFN
+#error Wrong FF_DIR_INDEX setting
+#endif
+#define DIX_MIN_ENT		64		/* Number of entries walked by a lookup to index the directory */
+#define DIX_DEL			0x0000FFFF	/* Slot of a removed object */
+#endif
+
+
 /* File lock controls */
 #if FF_FS_LOCK != 0
 #if FF_FS_READONLY
@@ -1069,6 +1093,26 @@ static void clear_lock (	/* Clear lock entries of the volume */
 /* Move/Flush disk access window in the filesystem object                */
 /*-----------------------------------------------------------------------*/
 #if !FF_FS_READONLY
+static FRESULT write_sect (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs,			/* Filesystem object */
+	const BYTE* buff,	/* Sector data to be written */
+	LBA_t sect			/* Sector LBA */
+)
+{
+	if (disk_write(fs->pdrv, buff, sect, 1) != RES_OK) return FR_DISK_ERR;	/* Write it into the volume */
+	if (sect - fs->fatbase < fs->fsize) {	/* Is it in the 1st FAT? */
+#if FF_FAT_DEFER
+		if (fs->fm_pend) {	/* Reflect it to 2nd FAT later if the 2nd FAT is out of date */
+			sect = (sect - fs->fatbase) >> fs->fm_shift;
+			fs->fm_map[sect / 8] |= 1 << (sect % 8);
+		} else
+#endif
+		if (fs->n_fats == 2) disk_write(fs->pdrv, buff, sect + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
+	}
+	return FR_OK;
+}
+
+
 static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 	FATFS* fs			/* Filesystem object */
 )
@@ -1077,20 +1121,162 @@ static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 	if (fs->wflag) {	/* Is the disk access window dirty? */
-		if (disk_write(fs->pdrv, fs->win, fs->winsect, 1) == RES_OK) {	/* Write it back into the volume */
-			fs->wflag = 0;	/* Clear window dirty flag */
-			if (fs->winsect - fs->fatbase < fs->fsize) {	/* Is it in the 1st FAT? */
-				if (fs->n_fats == 2) disk_write(fs->pdrv, fs->win, fs->winsect + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
+		res = write_sect(fs, fs->win, fs->winsect);	/* Write it back into the volume */
+		if (res == FR_OK) fs->wflag = 0;	/* Clear window dirty flag */
+	}
+	return res;
+}
+#endif
+
+
+#if FF_WIN_CACHE
+/*---------------------------------------------*/
+/* Sector cache behind the window              */
+/*---------------------------------------------*/
+/* A sector is either in the window or in a slot of the cache, so the content
+/  of the window is always the latest one and pointers into the window keep
+/  their meaning. */
+
+static void wc_init (
+	FATFS* fs			/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_WIN_CACHE; i++) {
+		fs->wc_sect[i] = (LBA_t)0 - 1; fs->wc_flag[i] = 0;
+	}
+	fs->wc_tick = fs->wc_hit = fs->wc_miss = fs->wc_wback = 0;
+}
+
+
+static void wc_inval (	/* Discard a range of sectors from the cache without write-back */
+	FATFS* fs,			/* Filesystem object */
+	LBA_t sect,			/* Start sector */
+	UINT cnt			/* Number of sectors */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_WIN_CACHE; i++) {
+		if (fs->wc_sect[i] - sect < cnt) {
+			fs->wc_sect[i] = (LBA_t)0 - 1; fs->wc_flag[i] = 0;
+		}
+	}
+}
+
+
+#if !FF_FS_READONLY
+static LBA_t wc_rank (	/* Write-back order of a sector */
+	FATFS* fs,			/* Filesystem object */
+	LBA_t sect			/* Sector LBA */
+)
+{
+	/* The FAT goes in descending order, so that a new cluster is marked in use before
+	/  the link to it is written, and then the directories in ascending order */
+	return (sect - fs->fatbase < fs->fsize) ? fs->fatbase + fs->fsize - 1 - (sect - fs->fatbase) : sect;
+}
+
+
+static FRESULT wc_flush (	/* Write-back the window and dirty slots in write-back order */
+	FATFS* fs,			/* Filesystem object */
+	LBA_t lim			/* Sector to be written back last ((LBA_t)0 - 1:all) */
+)
+{
+	UINT i, v;
+	LBA_t r, rv;
+
+
+	if (lim != (LBA_t)0 - 1) lim = wc_rank(fs, lim);
+	for (;;) {
+		for (i = 0, v = FF_WIN_CACHE, rv = 0; i < FF_WIN_CACHE; i++) {	/* Find the dirty sector to be written first */
+			if (fs->wc_flag[i] & 1) {
+				r = wc_rank(fs, fs->wc_sect[i]);
+				if (r <= lim && (v == FF_WIN_CACHE || r < rv)) { v = i; rv = r; }
+			}
+		}
+		if (fs->wflag) {	/* Window comes first? */
+			r = wc_rank(fs, fs->winsect);
+			if (r <= lim && (v == FF_WIN_CACHE || r < rv)) {
+				if (sync_window(fs) != FR_OK) return FR_DISK_ERR;
+				continue;
 			}
-		} else {
-			res = FR_DISK_ERR;
 		}
+		if (v == FF_WIN_CACHE) break;	/* All clean */
+		if (write_sect(fs, fs->wc_buf[v], fs->wc_sect[v]) != FR_OK) return FR_DISK_ERR;
+		fs->wc_flag[v] = 0;
+		fs->wc_wback++;
 	}
-	return res;
+	return FR_OK;
 }
 #endif
 
 
+static FRESULT wc_store (	/* Move the window into the cache. Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs			/* Filesystem object */
+)
+{
+	UINT i, v;
+	LBA_t sect = fs->winsect;
+
+
+	if (sect == (LBA_t)0 - 1) return FR_OK;	/* Window is not valid */
+#if FF_FS_TINY && !FF_FS_READONLY
+	if (sect >= fs->database) return fs->wflag ? wc_flush(fs, sect) : FR_OK;	/* File data is not cached */
+#endif
+	for (i = 0; i < FF_WIN_CACHE && fs->wc_sect[i] != sect; i++) ;	/* Is there an old copy of the sector? */
+	if (i == FF_WIN_CACHE) {	/* If not, take an empty slot or the least recently used one, clean ones first */
+		for (i = v = 0; i < FF_WIN_CACHE; i++) {
+			if (fs->wc_sect[i] == (LBA_t)0 - 1) { v = i; break; }
+			if ((fs->wc_flag[i] & 1) != (fs->wc_flag[v] & 1)) {
+				if (fs->wc_flag[v] & 1) v = i;
+			} else {
+				if (fs->wc_tick - fs->wc_age[i] > fs->wc_tick - fs->wc_age[v]) v = i;
+			}
+		}
+		i = v;
+#if !FF_FS_READONLY
+		if (fs->wc_flag[i] & 1) {	/* Write-back the evicted sector if dirty, and the sectors to be written before it */
+			if (wc_flush(fs, fs->wc_sect[i]) != FR_OK) return FR_DISK_ERR;
+		}
+#endif
+	}
+	mem_cpy(fs->wc_buf[i], fs->win, SS(fs));
+	fs->wc_sect[i] = sect;
+	fs->wc_flag[i] = fs->wflag;
+	fs->wc_age[i] = ++fs->wc_tick;
+	fs->wflag = 0;
+	return FR_OK;
+}
+
+
+static int wc_load (	/* 1:Hit (the window is filled), 0:Miss */
+	FATFS* fs,			/* Filesystem object */
+	LBA_t sect			/* Sector to bring into the window */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_WIN_CACHE; i++) {
+		if (fs->wc_sect[i] == sect) {
+			mem_cpy(fs->win, fs->wc_buf[i], SS(fs));
+			fs->wflag = fs->wc_flag[i];		/* Dirty status goes with the data */
+			fs->wc_sect[i] = (LBA_t)0 - 1; fs->wc_flag[i] = 0;
+			fs->wc_hit++;
+			return 1;
+		}
+	}
+	fs->wc_miss++;
+	return 0;
+}
+
+
+#endif	/* FF_WIN_CACHE */
+
+
 static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 	FATFS* fs,		/* Filesystem object */
 	LBA_t sect		/* Sector LBA to make appearance in the fs->win[] */
@@ -1100,7 +1286,13 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 	if (sect != fs->winsect) {	/* Window offset changed? */
-#if !FF_FS_READONLY
+#if FF_WIN_CACHE
+		res = wc_store(fs);			/* Put the window into the cache */
+		if (res == FR_OK && wc_load(fs, sect)) {	/* Found in the cache? */
+			fs->winsect = sect;
+			return FR_OK;
+		}
+#elif !FF_FS_READONLY
 		res = sync_window(fs);		/* Flush the window */
 #endif
 		if (res == FR_OK) {			/* Fill sector window with new data */
@@ -1117,6 +1309,143 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 
+#if FF_FAT_DEFER && !FF_FS_READONLY
+/*---------------------------------------------*/
+/* Deferred mirroring of the FAT               */
+/*---------------------------------------------*/
+/* While the 2nd FAT is out of date on a FAT32 volume with the FSInfo sector, a
+/  marker is put in a reserved field of the FSInfo, so that an interrupted
+/  mirroring can be finished at the next mount. Otherwise the state is kept
+/  only in the filesystem object, and the FATs are compared at every mount. */
+
+#define FSI_FM_MARK		0x524D4646	/* Marker in the FSInfo ("FFMR") */
+
+
+static FRESULT fm_copy (	/* Copy a sector of the 1st FAT into the 2nd FAT. Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs,			/* Filesystem object */
+	DWORD sect			/* Sector offset in the FAT */
+)
+{
+	if (move_window(fs, fs->fatbase + sect) != FR_OK) return FR_DISK_ERR;
+	if (disk_write(fs->pdrv, fs->win, fs->fatbase + fs->fsize + sect, 1) != RES_OK) return FR_DISK_ERR;
+	return FR_OK;
+}
+
+
+static FRESULT fm_fsi (	/* Put or clear the marker in the FSInfo. Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs,			/* Filesystem object */
+	DWORD mark			/* Value of the field (FSI_FM_MARK or 0) */
+)
+{
+	if (!fs->fm_fsi) return FR_OK;	/* The state is kept only in RAM */
+	if (move_window(fs, fs->volbase + 1) != FR_OK) return FR_DISK_ERR;
+	st_dword(fs->win + FSI_Reserved2, mark);
+	if (disk_write(fs->pdrv, fs->win, fs->winsect, 1) != RES_OK) return FR_DISK_ERR;	/* The window stays the same as the sector */
+	return FR_OK;
+}
+
+
+static FRESULT fm_mark (	/* Mark the 2nd FAT out of date. Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs			/* Filesystem object */
+)
+{
+	FRESULT res;
+
+
+	res = fm_fsi(fs, FSI_FM_MARK);	/* The marker must be on the disk before the FATs differ */
+	if (res == FR_OK) fs->fm_pend = 1;
+	return res;
+}
+
+
+static FRESULT fm_flush (	/* Bring the 2nd FAT up to date. Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs			/* Filesystem object */
+)
+{
+	FRESULT res;
+	DWORD i, s, e;
+
+
+#if FF_WIN_CACHE
+	res = wc_flush(fs, (LBA_t)0 - 1);	/* The 1st FAT on the disk must be the latest */
+#else
+	res = sync_window(fs);
+#endif
+	for (i = 0; res == FR_OK && i < sizeof fs->fm_map * 8; i++) {	/* Copy the marked sectors in ascending order */
+		if (fs->fm_map[i / 8] & (1 << (i % 8))) {
+			s = i << fs->fm_shift; e = s + ((DWORD)1 << fs->fm_shift);
+			if (e > fs->fsize) e = fs->fsize;
+			for ( ; res == FR_OK && s < e; s++) res = fm_copy(fs, s);
+		}
+	}
+	if (res == FR_OK) res = fm_fsi(fs, 0);	/* Clear the marker */
+	if (res == FR_OK) {
+		mem_set(fs->fm_map, 0, sizeof fs->fm_map);
+		fs->fm_pend = 0;
+	}
+	fs->fm_nsync = 0;
+	return res;
+}
+
+
+static DWORD fm_sum (	/* Check sum of a FAT sector (0xFFFFFFFF:disk error) */
+	FATFS* fs,			/* Filesystem object */
+	LBA_t sect			/* Sector LBA */
+)
+{
+	DWORD sum = 0x811C9DC5;
+	UINT i;
+
+
+	if (move_window(fs, sect) != FR_OK) return 0xFFFFFFFF;
+	for (i = 0; i < SS(fs); i++) sum = (sum ^ fs->win[i]) * 0x01000193;
+	return sum & 0x7FFFFFFF;
+}
+
+
+static FRESULT fm_init (	/* Initialize deferred mirroring at mount and finish an interrupted one. Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs,			/* Filesystem object */
+	BYTE fmt			/* FAT sub-type */
+)
+{
+	BYTE sh = 0;
+	DWORD s, sum;
+
+
+	while (((fs->fsize - 1) >> sh) >= sizeof fs->fm_map * 8) sh++;	/* Find number of sectors per bit to fit the FAT into the map */
+	fs->fm_shift = sh;
+	mem_set(fs->fm_map, 0, sizeof fs->fm_map);
+	fs->fm_pend = 0; fs->fm_nsync = 0; fs->fm_fsi = 0;
+	if (fs->n_fats != 2 || fmt == FS_EXFAT || (disk_status(fs->pdrv) & STA_PROTECT)) return FR_OK;
+
+	if (fmt == FS_FAT32 && fs->fsi_flag != 0x80) {	/* Is the FSInfo sector available? */
+		if (move_window(fs, fs->volbase + 1) != FR_OK) return FR_DISK_ERR;
+		if (ld_word(fs->win + BS_55AA) == 0xAA55
+			&& ld_dword(fs->win + FSI_LeadSig) == 0x41615252
+			&& ld_dword(fs->win + FSI_StrucSig) == 0x61417272)
+		{
+			fs->fm_fsi = 1;
+			if (ld_dword(fs->win + FSI_Reserved2) != FSI_FM_MARK) return FR_OK;	/* The 2nd FAT is up to date */
+			for (s = 0; s < fs->fsize; s++) {	/* Copy the whole FAT */
+				if (fm_copy(fs, s) != FR_OK) return FR_DISK_ERR;
+			}
+			return fm_fsi(fs, 0);
+		}
+	}
+	for (s = 0; s < fs->fsize; s++) {	/* Copy the sectors that differ */
+		sum = fm_sum(fs, fs->fatbase + fs->fsize + s);
+		if (sum == 0xFFFFFFFF) return FR_DISK_ERR;
+		if (fm_sum(fs, fs->fatbase + s) != sum) {
+			if (fm_copy(fs, s) != FR_OK) return FR_DISK_ERR;
+		}
+	}
+	return FR_OK;
+}
+#endif	/* FF_FAT_DEFER && !FF_FS_READONLY */
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Synchronize filesystem and data on the storage                        */
@@ -1129,7 +1458,19 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 	FRESULT res;
 
 
+#if FF_USE_BATCH
+	if (fs->batch) return FR_OK;	/* Deferred until the batch is committed */
+#endif
+#if FF_WIN_CACHE
+	res = wc_flush(fs, (LBA_t)0 - 1);
+#else
 	res = sync_window(fs);
+#endif
+#if FF_FAT_DEFER
+	if (res == FR_OK && fs->fm_pend && FF_FAT_DEFER_SYNC > 0 && ++fs->fm_nsync >= FF_FAT_DEFER_SYNC) {
+		res = fm_flush(fs);		/* Mirror the FAT at every FF_FAT_DEFER_SYNC-th sync */
+	}
+#endif
 	if (res == FR_OK) {
 		if (fs->fs_type == FS_FAT32 && fs->fsi_flag == 1) {	/* FAT32: Update FSInfo sector if needed */
 			/* Create FSInfo structure */
@@ -1139,8 +1480,14 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 			st_dword(fs->win + FSI_StrucSig, 0x61417272);
 			st_dword(fs->win + FSI_Free_Count, fs->free_clst);
 			st_dword(fs->win + FSI_Nxt_Free, fs->last_clst);
+#if FF_FAT_DEFER
+			if (fs->fm_pend && fs->fm_fsi) st_dword(fs->win + FSI_Reserved2, FSI_FM_MARK);	/* Keep the marker */
+#endif
 			/* Write it into the FSInfo sector */
 			fs->winsect = fs->volbase + 1;
+#if FF_WIN_CACHE
+			wc_inval(fs, fs->winsect, 1);	/* Window has the latest copy */
+#endif
 			disk_write(fs->pdrv, fs->win, fs->winsect, 1);
 			fs->fsi_flag = 0;
 		}
@@ -1265,6 +1612,12 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 
 
 	if (clst >= 2 && clst < fs->n_fatent) {	/* Check if in valid range */
+#if FF_FAT_DEFER
+		if (fs->n_fats == 2 && fs->fs_type != FS_EXFAT && !fs->fm_pend) {	/* The 2nd FAT goes out of date from now */
+			res = fm_mark(fs);
+			if (res != FR_OK) return res;
+		}
+#endif
 		switch (fs->fs_type) {
 		case FS_FAT12 :
 			bc = (UINT)clst; bc += bc / 2;	/* bc: byte offset of the entry */
@@ -1438,6 +1791,213 @@ static FRESULT fill_last_frag (
 
 
 
+#if !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Scan FAT16/32 entries for free clusters                */
+/*-----------------------------------------------------------------------*/
+/* The entries in the window are tested a 32-bit word at a time: a FAT32
+/  entry with a mask of the cluster number bits in the native byte order,
+/  two FAT16 entries at a time by testing both half words for zero. */
+
+static UINT scan_ent (	/* Number of free entries (mode 0) or index of the first free (mode 1) or used (mode 2) entry (n if not found) */
+	const BYTE* ptr,	/* Pointer to the first entry */
+	UINT n,				/* Number of entries to check */
+	UINT sz,			/* Size of an entry (2:FAT16, 4:FAT32) */
+	int mode			/* 0:Count free entries, 1:Find the first free entry, 2:Find the first entry in use */
+)
+{
+	static const BYTE m32[4] = {0xFF, 0xFF, 0xFF, 0x0F};
+	DWORD w, m, t;
+	UINT i, nf = 0;
+
+
+	if (sz == 4) {	/* FAT32 */
+		memcpy(&m, m32, 4);		/* Mask of cluster number in the native byte order */
+		if (mode == 1) {
+			for (i = 0; i < n; i++, ptr += 4) {
+				memcpy(&w, ptr, 4);
+				if ((w & m) == 0) return i;
+			}
+		} else if (mode == 2) {
+			for (i = 0; i < n; i++, ptr += 4) {
+				memcpy(&w, ptr, 4);
+				if ((w & m) != 0) return i;
+			}
+		} else {
+			for (i = 0; i < n; i++, ptr += 4) {
+				memcpy(&w, ptr, 4);
+				nf += ((w & m) == 0);
+			}
+		}
+	} else {		/* FAT16 */
+		for (i = 0; i + 2 <= n; i += 2, ptr += 4) {
+			memcpy(&w, ptr, 4);
+			t = ~(((w & 0x7FFF7FFF) + 0x7FFF7FFF) | w | 0x7FFF7FFF) & 0x80008000;	/* b15/b31: The half word is zero */
+			if (mode) {
+				if (mode == 2) t ^= 0x80008000;	/* b15/b31: The half word is not zero */
+				if (t != 0) return ((ld_word(ptr) == 0) == (mode == 1)) ? i : i + 1;
+			} else {
+				nf += (UINT)(t >> 15 & 1) + (UINT)(t >> 31);
+			}
+		}
+		if (i < n && (ld_word(ptr) == 0) == (mode != 2)) {	/* Odd entry left */
+			if (mode) return i;
+			nf++;
+		}
+	}
+	return mode ? n : nf;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Find a free (or used) cluster in a range               */
+/*-----------------------------------------------------------------------*/
+
+static DWORD find_free (	/* 0:Not found, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Found cluster# */
+	FFOBJID* obj,	/* Corresponding object */
+	DWORD clst,		/* Cluster to start to find (2..) */
+	DWORD ecl,		/* Cluster to end the find before (..n_fatent) */
+	int mode		/* 1:Find a free cluster, 2:Find a cluster in use */
+)
+{
+	FATFS *fs = obj->fs;
+	DWORD cs;
+	UINT sz, i, n;
+
+
+	if (fs->fs_type == FS_FAT12) {	/* FAT12: Check the entries one by one */
+		for ( ; clst < ecl; clst++) {
+			cs = get_fat(obj, clst);
+			if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
+			if ((cs == 0) == (mode == 1)) return clst;	/* Found it? */
+		}
+	} else {						/* FAT16/32: Scan the entries a sector at a time */
+		sz = (fs->fs_type == FS_FAT16) ? 2 : 4;
+		while (clst < ecl) {
+			if (move_window(fs, fs->fatbase + clst / (SS(fs) / sz)) != FR_OK) return 0xFFFFFFFF;
+			i = clst % (SS(fs) / sz);	/* Index of the entry in the sector */
+			n = SS(fs) / sz - i;		/* Number of entries to check in the sector */
+			if (n > ecl - clst) n = ecl - clst;
+			i = scan_ent(fs->win + i * sz, n, sz, mode);
+			if (i < n) return clst + i;	/* Found it? */
+			clst += n;
+		}
+	}
+	return 0;
+}
+
+#endif	/* !FF_FS_READONLY */
+
+
+
+#if FF_FAT_BITMAP && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Free cluster bitmap                                    */
+/*-----------------------------------------------------------------------*/
+/* Each bit of fs->bm[] covers a group of (1 << fs->bm_shift) clusters. A bit
+/  is cleared only when all clusters of the group have been found in use, so a
+/  cleared bit is a fact and a set bit is a hint to be checked on the FAT. */
+
+#if !defined(CTZ32)
+static UINT CTZ32 (	/* Returns number of trailing zero bits */
+	DWORD w			/* Non-zero value */
+)
+{
+	UINT n = 0;
+
+	while (!(w & 1)) {
+		w >>= 1; n++;
+	}
+	return n;
+}
+#endif
+
+
+/*------------------------------------------*/
+/* Initialize the bitmap                    */
+/*------------------------------------------*/
+
+static void bm_init (
+	FATFS* fs,	/* Filesystem object */
+	int bv		/* Value to set to all bits (0 or 1) */
+)
+{
+	BYTE sh = 0;
+
+
+	while (((fs->n_fatent - 3) >> sh) >= sizeof fs->bm * 8) sh++;	/* Find group size to fit the volume into the bitmap */
+	fs->bm_shift = sh;
+	mem_set(fs->bm, bv ? 0xFF : 0, sizeof fs->bm);
+}
+
+
+/*------------------------------------------*/
+/* Set/Clear the bit of a cluster           */
+/*------------------------------------------*/
+
+static void bm_put (
+	FATFS* fs,	/* Filesystem object */
+	DWORD clst,	/* Cluster number (2..) */
+	int bv		/* Bit value to be set (0 or 1) */
+)
+{
+	DWORD bi = (clst - 2) >> fs->bm_shift;
+
+
+	if (bv) {
+		fs->bm[bi / 32] |= (DWORD)1 << (bi % 32);
+	} else {
+		fs->bm[bi / 32] &= ~((DWORD)1 << (bi % 32));
+	}
+}
+
+
+/*------------------------------------------*/
+/* Find a free cluster                      */
+/*------------------------------------------*/
+
+static DWORD bm_find (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Free cluster# */
+	FFOBJID* obj,	/* Corresponding object */
+	DWORD scl		/* Cluster to start to find after (the search wraps around and ends at scl) */
+)
+{
+	FATFS *fs = obj->fs;
+	UINT sh = fs->bm_shift;
+	DWORD ncl, nxt, cs, bi, w, rem;
+	int top;
+
+
+	ncl = scl + 1;
+	rem = fs->n_fatent - 2;		/* Number of clusters to be checked */
+	while (rem) {
+		if (ncl >= fs->n_fatent) ncl = 2;	/* Wrap-around */
+		bi = (ncl - 2) >> sh;
+		w = fs->bm[bi / 32] >> (bi % 32);	/* Bits of the current group and following ones in the word */
+		nxt = ((bi + 1) << sh) + 2;			/* Top of next group */
+		if (nxt > fs->n_fatent) nxt = fs->n_fatent;
+		if (w & 1) {	/* The group may have a free cluster: check it on the FAT */
+			top = (ncl == (bi << sh) + 2 && nxt - ncl <= rem);	/* Check the whole group? */
+			if (nxt - ncl > rem) nxt = ncl + rem;
+			cs = find_free(obj, ncl, nxt, 1);
+			if (cs != 0) return cs;			/* Found a free cluster or error? */
+			rem -= nxt - ncl; ncl = nxt;
+			if (top) bm_put(fs, ncl - 1, 0);	/* No free cluster in the whole group */
+		} else {		/* Skip the groups with no free cluster, a word at a time */
+			nxt = (w != 0) ? bi + CTZ32(w) : (bi | 31) + 1;	/* Next group with the bit set */
+			nxt = (nxt << sh) + 2;
+			if (nxt > fs->n_fatent) nxt = fs->n_fatent;
+			cs = nxt - ncl;
+			if (cs > rem) cs = rem;
+			ncl += cs; rem -= cs;
+		}
+	}
+	return 0;
+}
+
+#endif	/* FF_FAT_BITMAP && !FF_FS_READONLY */
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Remove a cluster chain                                 */
@@ -1476,11 +2036,18 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 		if (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) {
 			res = put_fat(fs, clst, 0);		/* Mark the cluster 'free' on the FAT */
 			if (res != FR_OK) return res;
+#if FF_FAT_BITMAP
+			bm_put(fs, clst, 1);			/* Its group has a free cluster */
+#endif
+			if (clst < fs->fsc_clst) fs->fsc_nfree++;	/* Keep the count of the part already scanned */
 		}
 		if (fs->free_clst < fs->n_fatent - 2) {	/* Update FSINFO */
 			fs->free_clst++;
 			fs->fsi_flag |= 1;
 		}
+#if FF_WIN_CACHE
+		wc_inval(fs, clst2sect(fs, clst), fs->csize);	/* Dirty sectors of the freed cluster must not overwrite it after reuse */
+#endif
 #if FF_FS_EXFAT || FF_USE_TRIM
 		if (ecl + 1 == nxt) {	/* Is next cluster contiguous? */
 			ecl = nxt;
@@ -1559,7 +2126,7 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 		if (cs < fs->n_fatent) return cs;	/* It is already followed by next cluster */
 		scl = clst;							/* Cluster to start to find */
 	}
-	if (fs->free_clst == 0) return 0;		/* No free cluster */
+	if (fs->free_clst == 0 && fs->fsc_clst == 0) return 0;	/* No free cluster (and the count is not under verification) */
 
 #if FF_FS_EXFAT
 	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
@@ -1601,28 +2168,28 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 			}
 		}
 		if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
-			ncl = scl;	/* Start cluster */
-			for (;;) {
-				ncl++;							/* Next cluster */
-				if (ncl >= fs->n_fatent) {		/* Check wrap-around */
-					ncl = 2;
-					if (ncl > scl) return 0;	/* No free cluster found? */
-				}
-				cs = get_fat(obj, ncl);			/* Get the cluster status */
-				if (cs == 0) break;				/* Found a free cluster? */
-				if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
-				if (ncl == scl) return 0;		/* No free cluster found? */
-			}
+#if FF_FAT_BITMAP
+			ncl = bm_find(obj, scl);			/* Find a free cluster with the help of the bitmap */
+			if (ncl < 2 || ncl == 0xFFFFFFFF) return ncl;	/* No free cluster or error? */
+#else
+			ncl = find_free(obj, scl + 1, fs->n_fatent, 1);	/* Find a free cluster after the start cluster */
+			if (ncl == 0) ncl = find_free(obj, 2, scl + 1, 1);	/* Wrap-around */
+			if (ncl < 2 || ncl == 0xFFFFFFFF) return ncl;	/* No free cluster or error? */
+#endif
 		}
 		res = put_fat(fs, ncl, 0xFFFFFFFF);		/* Mark the new cluster 'EOC' */
 		if (res == FR_OK && clst != 0) {
 			res = put_fat(fs, clst, ncl);		/* Link it from the previous one if needed */
 		}
+#if FF_FAT_BITMAP
+		if (res == FR_OK && fs->bm_shift == 0) bm_put(fs, ncl, 0);	/* A bit per cluster: it is in use now */
+#endif
 	}
 
 	if (res == FR_OK) {			/* Update FSINFO if function succeeded. */
 		fs->last_clst = ncl;
 		if (fs->free_clst <= fs->n_fatent - 2) fs->free_clst--;
+		if (ncl < fs->fsc_clst) fs->fsc_nfree--;	/* Keep the count of the part already scanned */
 		fs->fsi_flag |= 1;
 	} else {
 		ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;	/* Failed. Generate error status */
@@ -1631,6 +2198,119 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 	return ncl;		/* Return new cluster number or error status */
 }
 
+
+
+
+#if FF_FS_MINIMIZE == 0
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Count free clusters                                    */
+/*-----------------------------------------------------------------------*/
+/* The scan can be split into several calls. Clusters allocated or freed
+/  between the calls are counted in by create_chain() and remove_chain() if
+/  they are in the part already scanned. */
+
+static FRESULT count_free (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* Filesystem object */
+	UINT nsect		/* Number of FAT sectors to scan at most (0:scan to the end) */
+)
+{
+	FRESULT res = FR_OK;
+	DWORD nfree, clst, stat;
+	LBA_t sect;
+	UINT i, sz, n;
+	FFOBJID obj;
+#if FF_FAT_BITMAP
+	DWORD e;
+	DWORD gm = ((DWORD)1 << fs->bm_shift) - 1;	/* Mask of cluster index in the bitmap group */
+	int gfree = 1;		/* Free cluster found in current group (or group not scanned from its top) */
+#endif
+
+
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {	/* exFAT: Scan allocation bitmap at once */
+		BYTE bm;
+		UINT b;
+
+		nfree = 0;
+		clst = fs->n_fatent - 2;	/* Number of clusters */
+		sect = fs->bitbase;			/* Bitmap sector */
+		i = 0;						/* Offset in the sector */
+		do {	/* Counts numbuer of bits with zero in the bitmap */
+			if (i == 0) {
+				res = move_window(fs, sect++);
+				if (res != FR_OK) break;
+			}
+			for (b = 8, bm = fs->win[i]; b && clst; b--, clst--) {
+				if (!(bm & 1)) nfree++;
+				bm >>= 1;
+			}
+			i = (i + 1) % SS(fs);
+		} while (clst);
+		if (res == FR_OK) {
+			fs->free_clst = nfree;	/* Now free_clst is valid */
+			fs->fsi_flag |= 1;
+		}
+		return res;
+	}
+#endif
+	if (fs->fsc_clst == 0) {	/* Start a new scan */
+		fs->fsc_clst = 2; fs->fsc_nfree = 0;
+	}
+	clst = fs->fsc_clst; nfree = fs->fsc_nfree;
+	if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries */
+		obj.fs = fs;
+		i = nsect * (SS(fs) * 2 / 3);	/* Number of entries to scan */
+		do {
+			stat = get_fat(&obj, clst);
+			if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+			if (stat == 1) { res = FR_INT_ERR; break; }
+#if FF_FAT_BITMAP
+			if (((clst - 2) & gm) == 0) gfree = 0;	/* Top of a group */
+			if (stat == 0) { gfree = 1; bm_put(fs, clst, 1); }
+			if (!gfree && (((clst - 2) & gm) == gm || clst == fs->n_fatent - 1)) bm_put(fs, clst, 0);	/* No free cluster in the whole group */
+#endif
+			if (stat == 0) nfree++;
+		} while (++clst < fs->n_fatent && (nsect == 0 || --i));
+	} else {	/* FAT16/32: Scan WORD/DWORD FAT entries a sector at a time */
+		sz = (fs->fs_type == FS_FAT16) ? 2 : 4;
+		sect = fs->fatbase + clst / (SS(fs) / sz);	/* FAT sector of the entry to start */
+		i = clst % (SS(fs) / sz) * sz;				/* Offset in the sector */
+		while (clst < fs->n_fatent) {
+			res = move_window(fs, sect++);
+			if (res != FR_OK) break;
+			n = (SS(fs) - i) / sz;	/* Number of entries to count in the sector */
+			if (n > fs->n_fatent - clst) n = fs->n_fatent - clst;
+#if FF_FAT_BITMAP
+			do {	/* Count free entries of each group in the sector */
+				e = ((clst - 2) | gm) - (clst - 2) + 1;	/* Entries to the end of the group */
+				if (e > n) e = n;
+				if (((clst - 2) & gm) == 0) gfree = 0;	/* Top of a group */
+				stat = scan_ent(fs->win + i, e, sz, 0);
+				if (stat != 0) { gfree = 1; bm_put(fs, clst, 1); }
+				nfree += stat; clst += e; i += e * sz; n -= e;
+				if (!gfree && (((clst - 3) & gm) == gm || clst == fs->n_fatent)) bm_put(fs, clst - 1, 0);	/* No free cluster in the whole group */
+			} while (n);
+#else
+			nfree += scan_ent(fs->win + i, n, sz, 0);	/* Count free entries in the sector */
+			clst += n;
+#endif
+			i = 0;
+			if (nsect != 0 && --nsect == 0) break;
+		}
+	}
+	if (res == FR_OK) {
+		if (clst >= fs->n_fatent) {	/* Whole FAT scanned? */
+			fs->free_clst = nfree;	/* Now free_clst is valid */
+			fs->fsi_flag |= 1;		/* FAT32: FSInfo is to be updated */
+			fs->fsc_clst = 0;
+		} else {					/* Save the progress */
+			fs->fsc_clst = clst; fs->fsc_nfree = nfree;
+		}
+	}
+	return res;
+}
+#endif	/* FF_FS_MINIMIZE == 0 */
+
 #endif /* !FF_FS_READONLY */
 
 
@@ -1681,8 +2361,15 @@ static FRESULT dir_clear (	/* Returns FR_OK or FR_DISK_ERR */
 	BYTE *ibuf;
 
 
+#if FF_WIN_CACHE
+	if (wc_store(fs) != FR_OK) return FR_DISK_ERR;	/* Put disk access window into the cache */
+#else
 	if (sync_window(fs) != FR_OK) return FR_DISK_ERR;	/* Flush disk access window */
+#endif
 	sect = clst2sect(fs, clst);		/* Top of the cluster */
+#if FF_WIN_CACHE
+	wc_inval(fs, sect, fs->csize);	/* Old copies of the cluster are no longer valid */
+#endif
 	fs->winsect = sect;				/* Set window to top of the cluster */
 	mem_set(fs->win, 0, sizeof fs->win);	/* Clear window buffer */
 #if FF_USE_LFN == 3		/* Quick table clear by using multi-secter write */
@@ -1904,7 +2591,7 @@ static int cmp_lfn (		/* 1:matched, 0:not matched */
 )
 {
 	UINT i, s;
-	WCHAR wc, uc;
+	WCHAR wc, uc, lc;
 
 
 	if (ld_word(dir + LDIR_FstClusLO) != 0) return 0;	/* Check LDIR_FstClusLO */
@@ -1914,7 +2601,9 @@ static int cmp_lfn (		/* 1:matched, 0:not matched */
 	for (wc = 1, s = 0; s < 13; s++) {		/* Process all characters in the entry */
 		uc = ld_word(dir + LfnOfs[s]);		/* Pick an LFN character */
 		if (wc != 0) {
-			if (i >= FF_MAX_LFN + 1 || ff_wtoupper(uc) != ff_wtoupper(lfnbuf[i++])) {	/* Compare it */
+			if (i >= FF_MAX_LFN + 1) return 0;	/* Name in the buffer is shorter */
+			lc = lfnbuf[i++];
+			if (uc != lc && WTOUPPER(uc) != WTOUPPER(lc)) {	/* Compare it */
 				return 0;					/* Not matched */
 			}
 			wc = uc;
@@ -2009,54 +2698,173 @@ static void put_lfn (
 /* FAT-LFN: Create a Numbered SFN                                        */
 /*-----------------------------------------------------------------------*/
 
-static void gen_numname (
-	BYTE* dst,			/* Pointer to the buffer to store numbered SFN */
-	const BYTE* src,	/* Pointer to SFN */
+static UINT hash_numname (	/* Hash number used for numbered SFN of sequence number > 5 */
 	const WCHAR* lfn,	/* Pointer to LFN */
 	UINT seq			/* Sequence number */
 )
 {
-	BYTE ns[8], c;
-	UINT i, j;
+	UINT i;
 	WCHAR wc;
 	DWORD sreg;
 
 
+	sreg = seq;
+	while (*lfn) {	/* Create a CRC as hash value */
+		wc = *lfn++;
+		for (i = 0; i < 16; i++) {
+			sreg = (sreg << 1) + (wc & 1);
+			wc >>= 1;
+			if (sreg & 0x10000) sreg ^= 0x11021;
+		}
+	}
+	return (UINT)sreg;
+}
+
+
+static void put_numtail (
+	BYTE* dst,			/* Pointer to the SFN to append the number */
+	UINT num			/* Number to append */
+)
+{
+	BYTE ns[8], c;
+	UINT i, j;
+
+
+	/* itoa (hexdecimal) */
+	i = 7;
+	do {
+		c = (BYTE)((num % 16) + '0');
+		if (c > '9') c += 7;
+		ns[i--] = c;
+		num /= 16;
+	} while (num);
+	ns[i] = '~';
+
+	/* Append the number to the SFN body */
+	for (j = 0; j < i && dst[j] != ' '; j++) {
+		if (dbc_1st(dst[j])) {
+			if (j == i - 1) break;
+			j++;
+		}
+	}
+	do {
+		dst[j++] = (i < 8) ? ns[i++] : ' ';
+	} while (j < 8);
+}
+
+
+static void gen_numname (
+	BYTE* dst,			/* Pointer to the buffer to store numbered SFN */
+	const BYTE* src,	/* Pointer to SFN */
+	const WCHAR* lfn,	/* Pointer to LFN */
+	UINT seq			/* Sequence number */
+)
+{
 	mem_cpy(dst, src, 11);
 
 	if (seq > 5) {	/* In case of many collisions, generate a hash number instead of sequential number */
-		sreg = seq;
-		while (*lfn) {	/* Create a CRC as hash value */
-			wc = *lfn++;
-			for (i = 0; i < 16; i++) {
-				sreg = (sreg << 1) + (wc & 1);
-				wc >>= 1;
-				if (sreg & 0x10000) sreg ^= 0x11021;
+		seq = hash_numname(lfn, seq);
+	}
+	put_numtail(dst, seq);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT-LFN: Find a free numbered SFN and free entries in a pass          */
+/*-----------------------------------------------------------------------*/
+/* Same result as trying gen_numname() with sequence number 1 to 99 and
+/  dir_find() for each of them, but the directory is read only once: the
+/  numbers used by the SFN entries of the directory are collected in a
+/  bitmap and a block of free entries is located in the same pass. */
+
+static FRESULT dir_numname (	/* FR_OK:succeeded, FR_DENIED:too many SFN collision or no free entry, FR_DISK_ERR:disk error */
+	DIR* dp,					/* Target directory, dp->fn gets the numbered SFN */
+	const BYTE* sn,				/* SFN to be numbered (with NSFLAG) */
+	UINT nent					/* Number of contiguous entries to allocate */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	BYTE used[13], nm[11], tp[4], hn[99 - 5], c, a;
+	WORD hv[99 - 5], bt[7];
+	DWORD fofs = 0xFFFFFFFF, x;
+	UINT n, i, j, nf = 0, end = 0, v;
+
+
+	/* Hash numbers of sequence number 6 to 99. The CRC is linear in its initial value, so
+	/  they are made of the hash with zero and the terms of each bit of the sequence number. */
+	for (n = 0; fs->lfnbuf[n]; n++) ;
+	for (i = 0; i < 7; i++) {
+		x = (DWORD)1 << i;
+		for (v = n * 16; v; v--) {
+			x <<= 1;
+			if (x & 0x10000) x ^= 0x11021;
+		}
+		bt[i] = (WORD)x;
+	}
+	x = hash_numname(fs->lfnbuf, 0);
+	for (n = 6; n < 100; n++) {		/* Put them in ascending order with the sequence numbers */
+		for (v = (WORD)x, i = 0; i < 7; i++) {
+			if (n & (1 << i)) v ^= bt[i];
+		}
+		for (j = n - 6; j > 0 && hv[j - 1] > v; j--) {
+			hv[j] = hv[j - 1]; hn[j] = hn[j - 1];
+		}
+		hv[j] = (WORD)v; hn[j] = (BYTE)n;
+	}
+	for (i = 0; i < 4; i++) {		/* Position of '~' in the numbered SFN of 1 to 4 digits */
+		mem_cpy(nm, sn, 11);
+		put_numtail(nm, 1 << (i * 4));
+		for (tp[i] = 0; nm[tp[i]] != '~'; tp[i]++) ;
+	}
+	mem_set(used, 0, sizeof used);
+	res = dir_sdi(dp, 0);
+	while (res == FR_OK) {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) break;
+		c = dp->dir[DIR_Name];
+		if (c == 0) end = 1;			/* Reached to end of table (following entries are all blank) */
+		if (end || c == DDEM) {			/* A blank entry */
+			if (fofs == 0xFFFFFFFF && ++nf == nent) fofs = dp->dptr;	/* A block of contiguous free entries is found */
+			if (end && fofs != 0xFFFFFFFF) break;
+		} else {
+			nf = 0;
+			a = dp->dir[DIR_Attr] & AM_MASK;
+			if (a != AM_LFN && !(a & AM_VOL) && !mem_cmp(dp->dir + 8, sn + 8, 3)) {	/* An SFN entry with the same extension */
+				for (i = 8; i > 0 && dp->dir[i - 1] == ' '; i--) ;	/* Find the numeric tail '~X..X' */
+				for (v = 0, n = 0; i > 0 && n < 4; i--, n++) {
+					c = dp->dir[i - 1];
+					if (c >= '0' && c <= '9') c -= '0';
+					else if (c >= 'A' && c <= 'F') c -= 'A' - 10;
+					else break;
+					v |= (UINT)c << (n * 4);
+				}
+				if (n >= 1 && i > 0 && dp->dir[i - 1] == '~') {
+					if (i - 1 == tp[n - 1] && !mem_cmp(dp->dir, sn, i - 1)) {	/* Is it the numbered SFN of the number? */
+						if (v >= 1 && v <= 5) used[v / 8] |= 1 << (v % 8);	/* Mark the sequence number used */
+						for (i = 0, j = 99 - 5; i < j; ) {	/* Find the hash number in the table */
+							n = (i + j) / 2;
+							if (hv[n] < v) i = n + 1; else j = n;
+						}
+						for ( ; i < 99 - 5 && hv[i] == v; i++) used[hn[i] / 8] |= 1 << (hn[i] % 8);
+					}
+				}
 			}
 		}
-		seq = (UINT)sreg;
+		res = dir_next(dp, 0);
 	}
+	if (res == FR_NO_FILE) res = FR_OK;		/* End of table */
+	if (res != FR_OK) return res;
 
-	/* itoa (hexdecimal) */
-	i = 7;
-	do {
-		c = (BYTE)((seq % 16) + '0');
-		if (c > '9') c += 7;
-		ns[i--] = c;
-		seq /= 16;
-	} while (seq);
-	ns[i] = '~';
+	for (n = 1; n < 100 && (used[n / 8] & (1 << (n % 8))); n++) ;	/* Find the first number not used */
+	if (n == 100) return FR_DENIED;			/* Too many collisions */
+	gen_numname(dp->fn, sn, fs->lfnbuf, n);	/* Generate the numbered name */
+	dp->fn[NSFLAG] = sn[NSFLAG];
 
-	/* Append the number to the SFN body */
-	for (j = 0; j < i && dst[j] != ' '; j++) {
-		if (dbc_1st(dst[j])) {
-			if (j == i - 1) break;
-			j++;
-		}
-	}
-	do {
-		dst[j++] = (i < 8) ? ns[i++] : ' ';
-	} while (j < 8);
+	/* Move to the free entries found, or find them with table stretch */
+	return (fofs != 0xFFFFFFFF) ? dir_sdi(dp, fofs) : dir_alloc(dp, nent);
 }
 #endif	/* FF_USE_LFN && !FF_FS_READONLY */
 
@@ -2439,8 +3247,9 @@ static FRESULT dir_read (
 /* Directory handling - Find an object in the directory                  */
 /*-----------------------------------------------------------------------*/
 
-static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp					/* Pointer to the directory object with the file name */
+static FRESULT find_ent (	/* FR_OK(0):succeeded, FR_NO_FILE:not found, !=0:error */
+	DIR* dp,				/* Pointer to the directory object at the entry to start */
+	int one					/* 0:Find to the end of the directory, 1:Check only the object at the entry */
 )
 {
 	FRESULT res;
@@ -2450,29 +3259,6 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	BYTE a, ord, sum;
 #endif
 
-	res = dir_sdi(dp, 0);			/* Rewind directory object */
-	if (res != FR_OK) return res;
-#if FF_FS_EXFAT
-	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
-		BYTE nc;
-		UINT di, ni;
-		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
-
-		while ((res = DIR_READ_FILE(dp)) == FR_OK) {	/* Read an item */
-#if FF_MAX_LFN < 255
-			if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) continue;			/* Skip comparison if inaccessible object name */
-#endif
-			if (ld_word(fs->dirbuf + XDIR_NameHash) != hash) continue;	/* Skip comparison if hash mismatched */
-			for (nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {	/* Compare the name */
-				if ((di % SZDIRE) == 0) di += 2;
-				if (ff_wtoupper(ld_word(fs->dirbuf + di)) != ff_wtoupper(fs->lfnbuf[ni])) break;
-			}
-			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
-		}
-		return res;
-	}
-#endif
-	/* On the FAT/FAT32 volume */
 #if FF_USE_LFN
 	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 #endif
@@ -2485,6 +3271,7 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 		dp->obj.attr = a = dp->dir[DIR_Attr] & AM_MASK;
 		if (c == DDEM || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
 			ord = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
+			if (one) { res = FR_NO_FILE; break; }
 		} else {
 			if (a == AM_LFN) {			/* An LFN entry is found */
 				if (!(dp->fn[NSFLAG] & NS_NOLFN)) {
@@ -2500,11 +3287,13 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 				if (ord == 0 && sum == sum_sfn(dp->dir)) break;	/* LFN matched? */
 				if (!(dp->fn[NSFLAG] & NS_LOSS) && !mem_cmp(dp->dir, dp->fn, 11)) break;	/* SFN matched? */
 				ord = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
+				if (one) { res = FR_NO_FILE; break; }
 			}
 		}
 #else		/* Non LFN configuration */
 		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
 		if (!(dp->dir[DIR_Attr] & AM_VOL) && !mem_cmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
+		if (one) { res = FR_NO_FILE; break; }
 #endif
 		res = dir_next(dp, 0);	/* Next entry */
 	} while (res == FR_OK);
@@ -2515,6 +3304,370 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 
 
 
+#if FF_DIR_INDEX
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Name index of a directory                        */
+/*-----------------------------------------------------------------------*/
+/* A slot of fs->dix_tbl[] holds a 16-bit hash of a name in b31-16 and the
+/  index of the first entry of the object (LFN or SFN) in b15-0. The LFN is
+/  hashed from its last character, so that it can be hashed on the fly while
+/  the LFN entries are read in the order on the directory. */
+
+static DWORD dix_hash_lfn (	/* Hash value */
+	DWORD h,				/* Hash value of the characters following these ones */
+	const WCHAR* lfn,		/* Pointer to the characters (Unicode) */
+	UINT len				/* Number of characters */
+)
+{
+	WCHAR wc;
+
+
+	while (len) {
+		wc = lfn[--len];
+		if (wc != 0 && wc != 0xFFFF) h = (h ^ WTOUPPER(wc)) * 0x01000193;	/* Skip terminator and padding */
+	}
+	return h;
+}
+
+
+static DWORD dix_hash_sfn (	/* Hash value */
+	const BYTE* sfn			/* Pointer to the SFN */
+)
+{
+	DWORD h = 0x84222325;
+	UINT n = 11;
+
+
+	do {
+		h = (h ^ *sfn++) * 0x01000193;
+	} while (--n);
+	return h;
+}
+
+
+static void dix_put (
+	FATFS* fs,		/* Filesystem object */
+	DWORD h,		/* Hash value of the name */
+	DWORD ent		/* Index of the first entry of the object */
+)
+{
+	UINT i;
+	WORD tag = (WORD)(h >> 16);
+
+
+	if (fs->dix_stat != 1) return;		/* Index is not complete? */
+	if (fs->dix_used >= FF_DIR_INDEX - FF_DIR_INDEX / 4) {	/* No more room in the index */
+		fs->dix_stat = 2;
+		return;
+	}
+	if (tag == 0) tag = 1;
+	for (i = h % FF_DIR_INDEX; fs->dix_tbl[i] >> 16; i = (i + 1) % FF_DIR_INDEX) ;	/* Find an empty slot */
+	if (fs->dix_tbl[i] == 0) fs->dix_used++;
+	fs->dix_tbl[i] = (DWORD)tag << 16 | (WORD)ent;
+}
+
+
+static void dix_del (
+	FATFS* fs,		/* Filesystem object */
+	DWORD ent		/* Index of the first entry of the object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_DIR_INDEX; i++) {
+		if ((fs->dix_tbl[i] >> 16) && (WORD)fs->dix_tbl[i] == (WORD)ent) fs->dix_tbl[i] = DIX_DEL;
+	}
+}
+
+
+static FRESULT dix_build (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp					/* Directory to be indexed */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DIR dj;
+	BYTE c, a, ord = 0xFF, sum = 0xFF;
+	DWORD h = 0, ent = 0;
+	WCHAR lfn[13];
+	UINT i;
+
+
+	mem_set(fs->dix_tbl, 0, sizeof fs->dix_tbl);	/* Empty the index */
+	fs->dix_used = 0; fs->dix_stat = 1;
+	fs->dix_sclust = dp->obj.sclust;
+	dj = *dp;
+	res = dir_sdi(&dj, 0);
+	while (res == FR_OK) {
+		res = move_window(fs, dj.sect);
+		if (res != FR_OK) break;
+		c = dj.dir[DIR_Name];
+		if (c == 0) break;		/* Reached to end of table */
+		a = dj.dir[DIR_Attr] & AM_MASK;
+		if (c == DDEM || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
+			ord = 0xFF;
+		} else if (a == AM_LFN) {		/* An LFN entry: hash its characters */
+			if (c & LLEF) {				/* Start of LFN sequence */
+				sum = dj.dir[LDIR_Chksum];
+				c &= (BYTE)~LLEF; ord = c;
+				ent = dj.dptr / SZDIRE; h = 0x811C9DC5;
+			}
+			if (c == ord && sum == dj.dir[LDIR_Chksum]) {
+				for (i = 0; i < 13; i++) lfn[i] = ld_word(dj.dir + LfnOfs[i]);
+				h = dix_hash_lfn(h, lfn, 13);
+				ord--;
+			} else {
+				ord = 0xFF;
+			}
+		} else {						/* An SFN entry: register the object */
+			if (ord == 0 && sum == sum_sfn(dj.dir)) {
+				dix_put(fs, h, ent);	/* LFN of the object */
+			} else {
+				ent = dj.dptr / SZDIRE;
+			}
+			dix_put(fs, dix_hash_sfn(dj.dir), ent);	/* SFN of the object */
+			ord = 0xFF;
+		}
+		res = dir_next(&dj, 0);
+	}
+	if (res == FR_NO_FILE) res = FR_OK;
+	if (res != FR_OK) fs->dix_sclust = 0xFFFFFFFF;
+	return res;
+}
+
+
+static FRESULT dix_find (	/* FR_OK(0):found, FR_NO_FILE:not in the index, !=0:error */
+	DIR* dp					/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DWORD h, v;
+	UINT i, n, k;
+	WORD tag;
+
+
+	for (k = 0; k < 2; k++) {
+		if (k == 0) {	/* Find by LFN */
+			if (dp->fn[NSFLAG] & NS_NOLFN) continue;
+			for (n = 0; fs->lfnbuf[n]; n++) ;
+			h = dix_hash_lfn(0x811C9DC5, fs->lfnbuf, n);
+		} else {		/* Find by SFN */
+			if (dp->fn[NSFLAG] & NS_LOSS) continue;
+			h = dix_hash_sfn(dp->fn);
+		}
+		tag = (WORD)(h >> 16);
+		if (tag == 0) tag = 1;
+		for (i = h % FF_DIR_INDEX, n = FF_DIR_INDEX; n && (v = fs->dix_tbl[i]) != 0; n--, i = (i + 1) % FF_DIR_INDEX) {
+			if ((WORD)(v >> 16) == tag) {	/* Check the object at the entry */
+				res = dir_sdi(dp, (v & 0xFFFF) * SZDIRE);
+				if (res == FR_OK) res = find_ent(dp, 1);
+				if (res != FR_NO_FILE) return res;	/* Found or error */
+			}
+		}
+	}
+	return FR_NO_FILE;
+}
+
+#endif	/* FF_DIR_INDEX */
+
+
+
+static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp					/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+#if FF_FS_EXFAT || FF_DIR_INDEX
+	FATFS *fs = dp->obj.fs;
+#endif
+
+	res = dir_sdi(dp, 0);			/* Rewind directory object */
+	if (res != FR_OK) return res;
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+		BYTE nc;
+		UINT di, ni;
+		WCHAR wc, lc;
+		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
+
+		while ((res = DIR_READ_FILE(dp)) == FR_OK) {	/* Read an item */
+#if FF_MAX_LFN < 255
+			if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) continue;			/* Skip comparison if inaccessible object name */
+#endif
+			if (ld_word(fs->dirbuf + XDIR_NameHash) != hash) continue;	/* Skip comparison if hash mismatched */
+			for (nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {	/* Compare the name */
+				if ((di % SZDIRE) == 0) di += 2;
+				wc = ld_word(fs->dirbuf + di); lc = fs->lfnbuf[ni];
+				if (wc != lc && WTOUPPER(wc) != WTOUPPER(lc)) break;
+			}
+			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
+		}
+		return res;
+	}
+#endif
+	/* On the FAT/FAT32 volume */
+#if FF_DIR_INDEX
+	if (dp->obj.sclust != fs->dix_sclust && dp->obj.sclust == fs->dix_cand) {	/* Index the directory at second costly lookup */
+		res = dix_build(dp);
+		if (res != FR_OK) return res;
+	}
+	if (dp->obj.sclust == fs->dix_sclust) {
+		res = dix_find(dp);
+		if (res != FR_NO_FILE || fs->dix_stat == 1) return res;	/* Found, error or not in the complete index */
+		res = dir_sdi(dp, 0);		/* Find it on the directory */
+		if (res != FR_OK) return res;
+	}
+	res = find_ent(dp, 0);
+	if (dp->dptr >= DIX_MIN_ENT * SZDIRE) fs->dix_cand = dp->obj.sclust;	/* Costly lookup: index the directory at next lookup */
+	return res;
+#else
+	return find_ent(dp, 0);
+#endif
+}
+
+
+
+
+#if FF_PATH_CACHE
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Path cache                                       */
+/*-----------------------------------------------------------------------*/
+/* An entry of fs->pc_ent[] is identified by the start cluster of the
+/  directory and two hash values of the segment name as given in the path.
+/  All entries are discarded whenever an object is registered or removed on
+/  the volume. A found object is checked against the name on the directory,
+/  so that a hash collision costs only a lookup. Sub-directories on the way
+/  are entered by the hash values alone. */
+
+static void pc_clear (
+	FATFS* fs		/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_PATH_CACHE; i++) fs->pc_ent[i].dir = 0xFFFFFFFF;
+}
+
+
+static FFPCENT* pc_get (	/* Pointer to the entry of the name (null:not in the cache) */
+	DIR* dp,				/* Directory object with the segment name */
+	DWORD* hash				/* Hash values of the segment name to be returned */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	FFPCENT *pe;
+	DWORD h0 = 0x811C9DC5, h1 = 0;
+	UINT i;
+#if FF_USE_LFN
+	const WCHAR *np = fs->lfnbuf;
+
+	while (*np) {
+		h0 = (h0 ^ *np) * 0x01000193;
+		h1 = h1 * 31 + *np++;
+	}
+#else
+	for (i = 0; i < 11; i++) {
+		h0 = (h0 ^ dp->fn[i]) * 0x01000193;
+		h1 = h1 * 31 + dp->fn[i];
+	}
+#endif
+	hash[0] = h0; hash[1] = h1;
+	for (i = 0; i < FF_PATH_CACHE; i++) {
+		pe = &fs->pc_ent[i];
+		if (pe->dir == dp->obj.sclust && pe->hash[0] == h0 && pe->hash[1] == h1) return pe;
+	}
+	return 0;
+}
+
+
+static int pc_enter (	/* 1:got into the sub-directory, 0:not in the cache */
+	DIR* dp				/* Directory object with the segment name */
+)
+{
+	FFPCENT *pe;
+	DWORD hash[2];
+
+
+	if (FF_FS_EXFAT && dp->obj.fs->fs_type == FS_EXFAT) return 0;	/* Not on the exFAT volume */
+	if (dp->fn[NSFLAG] & (NS_LAST | NS_DOT)) return 0;	/* Only a sub-directory on the way */
+	pe = pc_get(dp, hash);
+	if (!pe || !(pe->attr & AM_DIR)) return 0;	/* Leave it to pc_find() */
+	pe->age = ++dp->obj.fs->pc_tick;
+	dp->obj.fs->pc_hit++;
+	dp->obj.attr = pe->attr;
+	dp->obj.sclust = pe->sclust;	/* Open the sub-directory */
+	return 1;
+}
+
+
+static FRESULT pc_find (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp					/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	FFPCENT *pe;
+	DWORD hash[2], ofs;
+	UINT i;
+
+
+	if ((FF_FS_EXFAT && fs->fs_type == FS_EXFAT) || (dp->fn[NSFLAG] & NS_DOT)) return dir_find(dp);	/* Not cached */
+	pe = pc_get(dp, hash);
+	if (pe) {
+		res = move_window(fs, pe->sect);
+		if (res != FR_OK) return res;
+		dp->sect = pe->sect; dp->clust = pe->clust; dp->dptr = pe->dptr;
+		dp->dir = fs->win + dp->dptr % SS(fs);
+		res = find_ent(dp, 1);		/* Check the name of the object at the entry */
+		if (res != FR_NO_FILE) {	/* Found or error */
+			if (res == FR_OK) {
+				pe->age = ++fs->pc_tick;
+				fs->pc_hit++;
+			}
+			return res;
+		}
+		res = dir_sdi(dp, 0);		/* Hash collision: find it on the directory */
+		if (res != FR_OK) return res;
+	}
+
+	fs->pc_miss++;
+	res = dir_find(dp);
+	if (res != FR_OK) return res;	/* Not found or error (not cached) */
+	ofs = dp->dptr;
+#if FF_USE_LFN
+	if (dp->blk_ofs != 0xFFFFFFFF) ofs = dp->blk_ofs;
+#endif
+	if (dp->clust != 0 && ofs / SS(fs) / fs->csize != dp->dptr / SS(fs) / fs->csize) {	/* Not cached if the object spans clusters */
+		if (pe) pe->dir = 0xFFFFFFFF;
+		return res;
+	}
+	if (!pe) {
+		pe = &fs->pc_ent[0];
+		for (i = 0; i < FF_PATH_CACHE; i++) {	/* Find an empty or the least recently used entry */
+			if (fs->pc_ent[i].dir == 0xFFFFFFFF) {
+				pe = &fs->pc_ent[i]; break;
+			}
+			if (fs->pc_tick - fs->pc_ent[i].age > fs->pc_tick - pe->age) pe = &fs->pc_ent[i];
+		}
+	}
+	pe->dir = dp->obj.sclust;
+	pe->hash[0] = hash[0]; pe->hash[1] = hash[1];
+	pe->age = ++fs->pc_tick;
+	pe->attr = dp->obj.attr;
+	pe->sclust = ld_clust(fs, dp->dir);
+	pe->sect = dp->sect - (dp->dptr / SS(fs) - ofs / SS(fs));	/* Location of the first entry of the object */
+	pe->clust = dp->clust; pe->dptr = ofs;
+	return res;
+}
+
+#endif	/* FF_PATH_CACHE */
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Register an object to the directory                                   */
@@ -2527,7 +3680,10 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 	FRESULT res;
 	FATFS *fs = dp->obj.fs;
 #if FF_USE_LFN		/* LFN configuration */
-	UINT n, nlen, nent;
+	UINT nlen, nent;
+#if FF_DIR_INDEX
+	UINT n;
+#endif
 	BYTE sn[12], sum;
 
 
@@ -2567,7 +3723,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 #endif
 	/* On the FAT/FAT32 volume */
 	mem_cpy(sn, dp->fn, 12);
-	if (sn[NSFLAG] & NS_LOSS) {			/* When LFN is out of 8.3 format, generate a numbered name */
+	nent = (sn[NSFLAG] & NS_LFN) ? (nlen + 12) / 13 + 1 : 1;	/* Number of entries to allocate */
+#if FF_DIR_INDEX
+	if ((sn[NSFLAG] & NS_LOSS) && dp->obj.sclust == fs->dix_sclust && fs->dix_stat == 1) {	/* Numbered name with the help of the complete index */
 		dp->fn[NSFLAG] = NS_NOLFN;		/* Find only SFN */
 		for (n = 1; n < 100; n++) {
 			gen_numname(dp->fn, sn, fs->lfnbuf, n);	/* Generate a numbered name */
@@ -2577,11 +3735,22 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 		if (n == 100) return FR_DENIED;		/* Abort if too many collisions */
 		if (res != FR_NO_FILE) return res;	/* Abort if the result is other than 'not collided' */
 		dp->fn[NSFLAG] = sn[NSFLAG];
+		sn[NSFLAG] &= ~NS_LOSS;
 	}
+#endif
 
 	/* Create an SFN with/without LFNs. */
-	nent = (sn[NSFLAG] & NS_LFN) ? (nlen + 12) / 13 + 1 : 1;	/* Number of entries to allocate */
-	res = dir_alloc(dp, nent);		/* Allocate entries */
+	if (sn[NSFLAG] & NS_LOSS) {			/* When LFN is out of 8.3 format, generate a numbered name */
+		res = dir_numname(dp, sn, nent);	/* and allocate entries in the same pass */
+	} else {
+		res = dir_alloc(dp, nent);		/* Allocate entries */
+	}
+#if FF_DIR_INDEX
+	if (res == FR_OK && dp->obj.sclust == fs->dix_sclust) {	/* Register the object to the directory index */
+		if (nent > 1) dix_put(fs, dix_hash_lfn(0x811C9DC5, fs->lfnbuf, nlen), dp->dptr / SZDIRE - (nent - 1));
+		dix_put(fs, dix_hash_sfn(dp->fn), dp->dptr / SZDIRE - (nent - 1));
+	}
+#endif
 	if (res == FR_OK && --nent) {	/* Set LFN entry if needed */
 		res = dir_sdi(dp, dp->dptr - nent * SZDIRE);
 		if (res == FR_OK) {
@@ -2599,6 +3768,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 #else	/* Non LFN configuration */
 	res = dir_alloc(dp, 1);		/* Allocate an entry for SFN */
 
+#endif
+#if FF_PATH_CACHE
+	pc_clear(fs);		/* Discard the path cache */
 #endif
 
 	/* Set SFN entry */
@@ -2635,6 +3807,11 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 #if FF_USE_LFN		/* LFN configuration */
 	DWORD last = dp->dptr;
 
+#if FF_DIR_INDEX
+	if (dp->obj.sclust == fs->dix_sclust) {	/* Remove the object from the directory index */
+		dix_del(fs, ((dp->blk_ofs == 0xFFFFFFFF) ? dp->dptr : dp->blk_ofs) / SZDIRE);
+	}
+#endif
 	res = (dp->blk_ofs == 0xFFFFFFFF) ? FR_OK : dir_sdi(dp, dp->blk_ofs);	/* Goto top of the entry block if LFN is exist */
 	if (res == FR_OK) {
 		do {
@@ -2659,6 +3836,9 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 		fs->wflag = 1;
 	}
 #endif
+#if FF_PATH_CACHE
+	pc_clear(fs);		/* Discard the path cache */
+#endif
 
 	return res;
 }
@@ -3101,7 +4281,12 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 		for (;;) {
 			res = create_name(dp, &path);	/* Get a segment name of the path */
 			if (res != FR_OK) break;
+#if FF_PATH_CACHE
+			if (pc_enter(dp)) continue;		/* Got into the sub-directory by the path cache? */
+			res = pc_find(dp);				/* Find an object with the segment name in the path cache or on the directory */
+#else
 			res = dir_find(dp);				/* Find an object with the segment name */
+#endif
 			ns = dp->fn[NSFLAG];
 			if (res != FR_OK) {				/* Failed to find the object */
 				if (res == FR_NO_FILE) {	/* Object is not found */
@@ -3410,6 +4595,22 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	/* Following code attempts to mount the volume. (find a FAT volume, analyze the BPB and initialize the filesystem object) */
 
 	fs->fs_type = 0;					/* Clear the filesystem object */
+#if FF_WIN_CACHE
+	wc_init(fs);						/* Empty the sector cache */
+#endif
+#if FF_DIR_INDEX
+	fs->dix_sclust = fs->dix_cand = 0xFFFFFFFF;	/* No directory indexed */
+#endif
+#if FF_PATH_CACHE
+	pc_clear(fs);						/* Empty the path cache */
+	fs->pc_tick = fs->pc_hit = fs->pc_miss = 0;
+#endif
+#if !FF_FS_READONLY && FF_USE_BATCH
+	fs->batch = 0;						/* Not in a batch */
+#endif
+#if !FF_FS_READONLY && FF_FAT_DEFER
+	fs->fm_pend = 0;					/* The 2nd FAT is not out of date */
+#endif
 	fs->pdrv = LD2PD(vol);				/* Volume hosting physical drive */
 	stat = disk_initialize(fs->pdrv);	/* Initialize the physical drive */
 	if (stat & STA_NOINIT) { 			/* Check if the initialization succeeded */
@@ -3549,6 +4750,7 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 #if !FF_FS_READONLY
 		/* Get FSInfo if available */
 		fs->last_clst = fs->free_clst = 0xFFFFFFFF;		/* Initialize cluster allocation information */
+		fs->fsc_clst = 0;
 		fs->fsi_flag = 0x80;
 #if (FF_FS_NOFSINFO & 3) != 3
 		if (fmt == FS_FAT32				/* Allow to update FSInfo only if BPB_FSInfo32 == 1 */
@@ -3563,12 +4765,23 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 #if (FF_FS_NOFSINFO & 1) == 0
 				fs->free_clst = ld_dword(fs->win + FSI_Free_Count);
 #endif
+#if FF_USE_FREESCAN
+				if (fs->free_clst <= fs->n_fatent - 2) {	/* Trust it until f_scanfree() verifies it */
+					fs->fsc_clst = 2; fs->fsc_nfree = 0;
+				}
+#endif
 #if (FF_FS_NOFSINFO & 2) == 0
 				fs->last_clst = ld_dword(fs->win + FSI_Nxt_Free);
 #endif
 			}
 		}
 #endif	/* (FF_FS_NOFSINFO & 3) != 3 */
+#if FF_FAT_BITMAP
+		bm_init(fs, 1);		/* Every group may have free clusters */
+#endif
+#if FF_FAT_DEFER
+		if (fm_init(fs, (BYTE)fmt) != FR_OK) return FR_DISK_ERR;	/* Check if the 2nd FAT needs to be repaired */
+#endif
 #endif	/* !FF_FS_READONLY */
 	}
 
@@ -3648,7 +4861,7 @@ FRESULT f_mount (
 {
 	FATFS *cfs;
 	int vol;
-	FRESULT res;
+	FRESULT res, fres = FR_OK;
 	const TCHAR *rp = path;
 
 
@@ -3658,6 +4871,17 @@ FRESULT f_mount (
 	cfs = FatFs[vol];					/* Pointer to fs object */
 
 	if (cfs) {
+#if FF_FAT_DEFER && !FF_FS_READONLY
+		if (cfs->fs_type != 0 && cfs->fm_pend) {	/* Bring the 2nd FAT up to date */
+#if FF_FS_REENTRANT
+			if (!lock_fs(cfs)) return FR_TIMEOUT;
+#endif
+			fres = fm_flush(cfs);		/* On error, fm_init() finishes it at next mount */
+#if FF_FS_REENTRANT
+			unlock_fs(cfs, fres);
+#endif
+		}
+#endif
 #if FF_FS_LOCK != 0
 		clear_lock(cfs);
 #endif
@@ -3671,13 +4895,17 @@ FRESULT f_mount (
 		fs->fs_type = 0;				/* Clear new fs object */
 #if FF_FS_REENTRANT						/* Create sync object for the new volume */
 		if (!ff_cre_syncobj((BYTE)vol, &fs->sobj)) return FR_INT_ERR;
+#endif
+#if FF_USE_LFN && FF_CVT_DIRECT && FF_CODE_PAGE == 0
+		ff_cvtinit(CODEPAGE);			/* Expand the code conversion tables */
 #endif
 	}
 	FatFs[vol] = fs;					/* Register new fs object */
 
-	if (opt == 0) return FR_OK;			/* Do not mount now, it will be mounted later */
+	if (opt == 0) return fres;			/* Do not mount now, it will be mounted later */
 
 	res = mount_volume(&path, &fs, 0);	/* Force mounted the volume */
+	if (res == FR_OK) res = fres;
 	LEAVE_FF(fs, res);
 }
 
@@ -3688,8 +4916,33 @@ FRESULT f_mount (
 /* Open or Create a File                                                 */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_open (
+#if FF_FS_RPATH
+static FRESULT chk_base (	/* FR_OK(0):the directory is on the volume, FR_NO_PATH:it has been removed, !=0:error */
+	DIR* dp					/* Pointer to the open directory */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DWORD clst = dp->obj.sclust, val;
+
+
+	if (clst == 0 || (FF_FS_EXFAT && fs->fs_type == FS_EXFAT)) return FR_OK;	/* Root directory or exFAT (follow_path() checks the entry) */
+	val = get_fat(&dp->obj, clst);
+	if (val == 0xFFFFFFFF) return FR_DISK_ERR;
+	if (val < 2) return FR_NO_PATH;		/* The cluster has been freed */
+	res = move_window(fs, clst2sect(fs, clst));
+	if (res != FR_OK) return res;
+	if (fs->win[DIR_Name] != '.' || fs->win[DIR_Name + 1] != ' ' || ld_clust(fs, fs->win) != clst) {
+		return FR_NO_PATH;				/* The cluster is no longer the directory */
+	}
+	return FR_OK;
+}
+#endif
+
+
+static FRESULT open_file (
 	FIL* fp,			/* Pointer to the blank file object */
+	DIR* base,			/* Pointer to the open directory the path is relative to (null:current directory) */
 	const TCHAR* path,	/* Pointer to the file name */
 	BYTE mode			/* Access mode and file open mode flags */
 )
@@ -3701,19 +4954,53 @@ FRESULT f_open (
 	DWORD cl, bcs, clst;
 	LBA_t sc;
 	FSIZE_t ofs;
+#endif
+#if FF_FS_RPATH
+	DWORD cdir;
+#if FF_FS_EXFAT
+	DWORD cdc_scl, cdc_size, cdc_ofs;
+#endif
 #endif
 	DEF_NAMBUF
 
 
 	if (!fp) return FR_INVALID_OBJECT;
 
-	/* Get logical drive number */
 	mode &= FF_FS_READONLY ? FA_READ : FA_READ | FA_WRITE | FA_CREATE_ALWAYS | FA_CREATE_NEW | FA_OPEN_ALWAYS | FA_OPEN_APPEND;
-	res = mount_volume(&path, &fs, mode);
+#if !FF_FS_RPATH
+	(void)base;		/* Relative open is not available */
+#else
+	if (base) {		/* Get the volume of the open directory */
+		res = validate(&base->obj, &fs);
+		if (res == FR_OK && !FF_FS_READONLY && (mode & ~FA_READ) && (disk_status(fs->pdrv) & STA_PROTECT)) {
+			res = FR_WRITE_PROTECTED;
+		}
+		if (res == FR_OK) res = chk_base(base);	/* Reject the directory if it has been removed */
+	} else
+#endif
+	{				/* Get logical drive number */
+		res = mount_volume(&path, &fs, mode);
+	}
 	if (res == FR_OK) {
 		dj.obj.fs = fs;
 		INIT_NAMBUF(fs);
-		res = follow_path(&dj, path);	/* Follow the file path */
+#if FF_FS_RPATH
+		if (base) {	/* Follow the file path from the open directory as current directory */
+			cdir = fs->cdir; fs->cdir = base->obj.sclust;
+#if FF_FS_EXFAT
+			cdc_scl = fs->cdc_scl; cdc_size = fs->cdc_size; cdc_ofs = fs->cdc_ofs;
+			fs->cdc_scl = base->obj.c_scl; fs->cdc_size = base->obj.c_size; fs->cdc_ofs = base->obj.c_ofs;
+#endif
+			res = follow_path(&dj, path);
+			fs->cdir = cdir;
+#if FF_FS_EXFAT
+			fs->cdc_scl = cdc_scl; fs->cdc_size = cdc_size; fs->cdc_ofs = cdc_ofs;
+#endif
+		} else
+#endif
+		{
+			res = follow_path(&dj, path);	/* Follow the file path */
+		}
 #if !FF_FS_READONLY	/* Read/Write configuration */
 		if (res == FR_OK) {
 			if (dj.fn[NSFLAG] & NS_NONAME) {	/* Origin directory itself? */
@@ -3773,7 +5060,12 @@ FRESULT f_open (
 					fs->wflag = 1;
 					if (cl != 0) {						/* Remove the cluster chain if exist */
 						sc = fs->winsect;
+#if FF_WIN_CACHE
+						res = wc_flush(fs, sc);			/* The entry must not refer to the chain on the disk when it is freed */
+						if (res == FR_OK) res = remove_chain(&dj.obj, cl, 0);
+#else
 						res = remove_chain(&dj.obj, cl, 0);
+#endif
 						if (res == FR_OK) {
 							res = move_window(fs, sc);
 							fs->last_clst = cl - 1;		/* Reuse the cluster hole */
@@ -3874,6 +5166,39 @@ FRESULT f_open (
 }
 
 
+FRESULT f_open (
+	FIL* fp,			/* Pointer to the blank file object */
+	const TCHAR* path,	/* Pointer to the file name */
+	BYTE mode			/* Access mode and file open mode flags */
+)
+{
+	return open_file(fp, 0, path, mode);
+}
+
+
+#if FF_FS_RPATH
+/*-----------------------------------------------------------------------*/
+/* Open or Create a File Relative to an Open Directory                   */
+/*-----------------------------------------------------------------------*/
+/* A relative path is followed from the directory instead of the current
+/  directory, so that the parent directories are not looked up again. The
+/  open directory is not protected against removal unless FF_FS_LOCK is
+/  enabled. A removed one is rejected with FR_NO_PATH, but not if another
+/  sub-directory has been created in its cluster since. */
+
+FRESULT f_openat (
+	FIL* fp,			/* Pointer to the blank file object */
+	DIR* dp,			/* Pointer to the open directory */
+	const TCHAR* path,	/* Pointer to the file name relative to the directory */
+	BYTE mode			/* Access mode and file open mode flags */
+)
+{
+	if (!dp) return FR_INVALID_OBJECT;
+	return open_file(fp, dp, path, mode);
+}
+#endif
+
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -3892,7 +5217,7 @@ FRESULT f_read (
 	DWORD clst;
 	LBA_t sect;
 	FSIZE_t remain;
-	UINT rcnt, cc, csect;
+	UINT rcnt, cc, csect, n;
 	BYTE *rbuff = (BYTE*)buff;
 
 
@@ -3929,8 +5254,22 @@ FRESULT f_read (
 			sect += csect;
 			cc = btr / SS(fs);					/* When remaining bytes >= sector size, */
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
-				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
-					cc = fs->csize - csect;
+				if (csect + cc > fs->csize) {	/* Clip at the end of contiguous clusters */
+					n = fs->csize - csect;
+					while (n < cc) {			/* Take in the next clusters while they follow on the volume */
+#if FF_USE_FASTSEEK
+						if (fp->cltbl) {
+							clst = clmt_clust(fp, fp->fptr + (FSIZE_t)n * SS(fs));
+						} else
+#endif
+						{
+							clst = get_fat(&fp->obj, fp->clust);
+						}
+						if (clst != fp->clust + 1) break;	/* Fragmented or error (checked at next cluster) */
+						fp->clust = clst;
+						n += fs->csize;
+					}
+					if (cc > n) cc = n;
 				}
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
@@ -4067,7 +5406,11 @@ FRESULT f_write (
 			}
 #if FF_FS_TINY
 			if (fp->fptr >= fp->obj.objsize) {	/* Avoid silly cache filling on the growing edge */
+#if FF_WIN_CACHE
+				if (wc_store(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);
+#else
 				if (sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);
+#endif
 				fs->winsect = sect;
 			}
 #else
@@ -4180,6 +5523,66 @@ FRESULT f_sync (
 
 
 
+#if FF_USE_FASTSEEK
+/*-----------------------------------------------------------------------*/
+/* Advance File Pointer over Sectors Transferred outside FatFs           */
+/*-----------------------------------------------------------------------*/
+/* The sectors are read/written with disk_read/disk_write straight from/to
+/  the volume. The file must be a contiguous cluster chain (f_expand) and the
+/  sector buffer must have been flushed (f_sync) before the transfer. */
+
+FRESULT f_rawadvance (
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t ofs,	/* Number of bytes to advance (multiple of sector size) */
+	BYTE wr			/* 0:Sectors were read, 1:Sectors were written */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	FSIZE_t pos;
+	DWORD bcs;
+#if !FF_FS_READONLY
+	LBA_t sect;
+#endif
+
+
+	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	pos = fp->fptr + ofs;
+	if (pos < fp->fptr || fp->obj.sclust == 0 || fp->fptr % SS(fs) != 0 || ofs % SS(fs) != 0) LEAVE_FF(fs, FR_INVALID_PARAMETER);
+#if !FF_FS_TINY
+	if (fp->flag & FA_DIRTY) LEAVE_FF(fs, FR_DENIED);	/* Sector buffer is not flushed */
+#endif
+	if (wr) {
+#if FF_FS_READONLY
+		LEAVE_FF(fs, FR_DENIED);
+#else
+		if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);
+		sect = clst2sect(fs, fp->obj.sclust) + (LBA_t)(fp->fptr / SS(fs));	/* First sector written */
+		if (pos > fp->obj.objsize) fp->obj.objsize = pos;	/* Enlarge the file size */
+		fp->flag |= FA_MODIFIED;
+		if (fs->winsect - sect < ofs / SS(fs)) {	/* Discard old copy in the window */
+			fs->winsect = (LBA_t)0 - 1; fs->wflag = 0;
+		}
+#if FF_WIN_CACHE
+		wc_inval(fs, sect, (UINT)(ofs / SS(fs)));	/* Discard old copies in the cache */
+#endif
+#endif
+	} else {
+		if (pos > fp->obj.objsize) pos = fp->obj.objsize / SS(fs) * SS(fs);	/* Stop at the last sector of data */
+	}
+	bcs = (DWORD)fs->csize * SS(fs);	/* Cluster size */
+	if (pos > 0) fp->clust = fp->obj.sclust + (DWORD)((pos - 1) / bcs);	/* The chain is contiguous */
+	fp->fptr = pos;
+	fp->sect = 0;	/* Sector buffer is no longer valid */
+
+	LEAVE_FF(fs, FR_OK);
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Close File                                                            */
 /*-----------------------------------------------------------------------*/
@@ -4789,10 +6192,6 @@ FRESULT f_getfree (
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD nfree, clst, stat;
-	LBA_t sect;
-	UINT i;
-	FFOBJID obj;
 
 
 	/* Get logical drive */
@@ -4800,69 +6199,88 @@ FRESULT f_getfree (
 	if (res == FR_OK) {
 		*fatfs = fs;				/* Return ptr to the fs object */
 		/* If free_clst is valid, return it without full FAT scan */
-		if (fs->free_clst <= fs->n_fatent - 2) {
-			*nclst = fs->free_clst;
-		} else {
-			/* Scan FAT to obtain number of free clusters */
-			nfree = 0;
-			if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries */
-				clst = 2; obj.fs = fs;
-				do {
-					stat = get_fat(&obj, clst);
-					if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
-					if (stat == 1) { res = FR_INT_ERR; break; }
-					if (stat == 0) nfree++;
-				} while (++clst < fs->n_fatent);
-			} else {
-#if FF_FS_EXFAT
-				if (fs->fs_type == FS_EXFAT) {	/* exFAT: Scan allocation bitmap */
-					BYTE bm;
-					UINT b;
-
-					clst = fs->n_fatent - 2;	/* Number of clusters */
-					sect = fs->bitbase;			/* Bitmap sector */
-					i = 0;						/* Offset in the sector */
-					do {	/* Counts numbuer of bits with zero in the bitmap */
-						if (i == 0) {
-							res = move_window(fs, sect++);
-							if (res != FR_OK) break;
-						}
-						for (b = 8, bm = fs->win[i]; b && clst; b--, clst--) {
-							if (!(bm & 1)) nfree++;
-							bm >>= 1;
-						}
-						i = (i + 1) % SS(fs);
-					} while (clst);
-				} else
+		if (fs->free_clst > fs->n_fatent - 2) {
+			res = count_free(fs, 0);	/* Scan FAT (or the rest of a scan in progress) to obtain number of free clusters */
+		}
+		if (res == FR_OK) *nclst = fs->free_clst;
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+#if FF_USE_FREESCAN
+/*-----------------------------------------------------------------------*/
+/* Count Free Clusters Step by Step                                      */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_scanfree (
+	const TCHAR* path,	/* Logical drive number */
+	UINT nsect,			/* Number of FAT sectors to scan at most in this call (0:to the end) */
+	DWORD* nclst,		/* Pointer to a variable to return number of free clusters (0xFFFFFFFF:not known yet) */
+	DWORD* nleft		/* Pointer to a variable to return number of FAT entries left to scan (0:count is verified) */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	/* Get logical drive */
+	res = mount_volume(&path, &fs, 0);
+	if (res == FR_OK) {
+		/* Scan a part of the FAT unless the count is already valid and verified */
+		if (fs->fsc_clst != 0 || fs->free_clst > fs->n_fatent - 2) {
+			res = count_free(fs, nsect);
+		}
+		if (res == FR_OK) {
+			*nclst = (fs->free_clst <= fs->n_fatent - 2) ? fs->free_clst : 0xFFFFFFFF;
+			*nleft = (fs->fsc_clst != 0) ? fs->n_fatent - fs->fsc_clst : 0;
+		}
+	}
+
+	LEAVE_FF(fs, res);
+}
 #endif
-				{	/* FAT16/32: Scan WORD/DWORD FAT entries */
-					clst = fs->n_fatent;	/* Number of entries */
-					sect = fs->fatbase;		/* Top of the FAT */
-					i = 0;					/* Offset in the sector */
-					do {	/* Counts numbuer of entries with zero in the FAT */
-						if (i == 0) {
-							res = move_window(fs, sect++);
-							if (res != FR_OK) break;
-						}
-						if (fs->fs_type == FS_FAT16) {
-							if (ld_word(fs->win + i) == 0) nfree++;
-							i += 2;
-						} else {
-							if ((ld_dword(fs->win + i) & 0x0FFFFFFF) == 0) nfree++;
-							i += 4;
-						}
-						i %= SS(fs);
-					} while (--clst);
-				}
+
+
+
+#if FF_USE_BATCH
+/*-----------------------------------------------------------------------*/
+/* Begin/Commit a Batch of Updates                                       */
+/*-----------------------------------------------------------------------*/
+/* While a batch is open, the functions that update the volume leave the
+/  dirty window (and the dirty sectors of the cache) in memory and do not
+/  update the FSINFO nor issue CTRL_SYNC. The deferred sectors are written
+/  in LBA order (FAT from the end) when the batch is committed. Batches can be nested
+/  and only the outermost commit synchronizes the volume. */
+
+FRESULT f_batch (
+	const TCHAR* path,	/* Logical drive number */
+	BYTE opt			/* 1:Begin a batch, 0:Commit the batch */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = mount_volume(&path, &fs, FA_WRITE);	/* Get logical drive */
+	if (res == FR_OK) {
+		if (opt) {
+			if (fs->batch == 0xFF) {
+				res = FR_INT_ERR;		/* Too deep nesting */
+			} else {
+				fs->batch++;
 			}
-			*nclst = nfree;			/* Return the free clusters */
-			fs->free_clst = nfree;	/* Now free_clst is valid */
-			fs->fsi_flag |= 1;		/* FAT32: FSInfo is to be updated */
+		} else {
+			if (fs->batch) fs->batch--;
+			if (fs->batch == 0) res = sync_fs(fs);	/* Write all deferred updates */
 		}
 	}
 
 	LEAVE_FF(fs, res);
 }
+#endif
 
 
 
@@ -4992,6 +6410,13 @@ FRESULT f_unlink (
 			}
 			if (res == FR_OK) {
 				res = dir_remove(&dj);			/* Remove the directory entry */
+#if FF_DIR_INDEX
+				if (dclst != 0 && dclst == fs->dix_sclust) fs->dix_sclust = 0xFFFFFFFF;	/* Forget the index of the directory */
+				if (dclst != 0 && dclst == fs->dix_cand) fs->dix_cand = 0xFFFFFFFF;
+#endif
+#if FF_WIN_CACHE
+				if (res == FR_OK && dclst != 0) res = wc_flush(fs, fs->winsect);	/* The entry must not refer to the chain on the disk when it is freed */
+#endif
 				if (res == FR_OK && dclst != 0) {	/* Remove the cluster chain if exist */
 #if FF_FS_EXFAT
 					res = remove_chain(&obj, dclst, 0);
@@ -5556,18 +6981,20 @@ FRESULT f_expand (
 	} else
 #endif
 	{
-		scl = clst = stcl; ncl = 0;
-		for (;;) {	/* Find a contiguous cluster block */
-			n = get_fat(&fp->obj, clst);
-			if (++clst >= fs->n_fatent) clst = 2;
+		clst = stcl; ncl = 0;	/* ncl: 1 after wrap-around */
+		for (;;) {	/* Find a contiguous cluster block, a free cluster and then the end of free block */
+			scl = (clst + tcl <= fs->n_fatent) ? find_free(&fp->obj, clst, fs->n_fatent - tcl + 1, 1) : 0;	/* Top of the block */
+			if (scl == 1) { res = FR_INT_ERR; break; }
+			if (scl == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+			if (scl == 0 || (ncl && scl >= stcl)) {	/* No more block in this round? */
+				if (ncl || stcl == 2) { res = FR_DENIED; break; }	/* No contiguous cluster? */
+				clst = 2; ncl = 1; continue;		/* Wrap-around */
+			}
+			n = find_free(&fp->obj, scl, scl + tcl, 2);	/* Find a cluster in use in the block */
+			if (n == 0) break;						/* Break if a contiguous cluster block is found */
 			if (n == 1) { res = FR_INT_ERR; break; }
 			if (n == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
-			if (n == 0) {	/* Is it a free cluster? */
-				if (++ncl == tcl) break;	/* Break if a contiguous cluster block is found */
-			} else {
-				scl = clst; ncl = 0;		/* Not a free cluster */
-			}
-			if (clst == stcl) { res = FR_DENIED; break; }	/* No contiguous cluster? */
+			clst = n + 1;							/* Go on after the cluster in use */
 		}
 		if (res == FR_OK) {	/* A contiguous free area is found */
 			if (opt) {		/* Allocate it now */
@@ -5593,6 +7020,9 @@ FRESULT f_expand (
 				fs->free_clst -= tcl;
 				fs->fsi_flag |= 1;
 			}
+			if (scl < fs->fsc_clst) {	/* Keep the count of the part already scanned */
+				fs->fsc_nfree -= (scl + tcl < fs->fsc_clst ? scl + tcl : fs->fsc_clst) - scl;
+			}
 		}
 	}
 
@@ -5637,8 +7067,15 @@ FRESULT f_forward (
 		csect = (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Sector offset in the cluster */
 		if (fp->fptr % SS(fs) == 0) {				/* On the sector boundary? */
 			if (csect == 0) {						/* On the cluster boundary? */
-				clst = (fp->fptr == 0) ?			/* On the top of the file? */
-					fp->obj.sclust : get_fat(&fp->obj, fp->clust);
+#if FF_USE_FASTSEEK
+				if (fp->fptr != 0 && fp->cltbl) {
+					clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
+				} else
+#endif
+				{
+					clst = (fp->fptr == 0) ?		/* On the top of the file? */
+						fp->obj.sclust : get_fat(&fp->obj, fp->clust);
+				}
 				if (clst <= 1) ABORT(fs, FR_INT_ERR);
 				if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
 				fp->clust = clst;					/* Update current cluster */
@@ -5671,6 +7108,122 @@ FRESULT f_forward (
 
 	LEAVE_FF(fs, FR_OK);
 }
+
+
+/*-----------------------------------------------------------------------*/
+/* Forward Runs of Contiguous Sectors to the Stream                      */
+/*-----------------------------------------------------------------------*/
+/* Same as f_forward() but the file data on sector boundaries is read into
+/  the given buffer with a multi-sector read, as many contiguous sectors as
+/  fit in the buffer across contiguous clusters, and the whole run is passed
+/  to the streaming function in a call. */
+
+FRESULT f_forwardrun (
+	FIL* fp, 						/* Pointer to the file object */
+	UINT (*func)(const BYTE*,UINT),	/* Pointer to the streaming function */
+	BYTE* buff,						/* Pointer to the buffer to read the runs into */
+	UINT szbuf,						/* Size of the buffer [byte] (1 sector at least) */
+	UINT btf,						/* Number of bytes to forward */
+	UINT* bf						/* Pointer to number of bytes forwarded */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD clst, nclst;
+	LBA_t sect;
+	FSIZE_t remain;
+	UINT rcnt, csect, cc, n;
+	BYTE *dbuf;
+
+
+	*bf = 0;	/* Clear transfer byte counter */
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+	if (szbuf < SS(fs)) LEAVE_FF(fs, FR_INVALID_PARAMETER);
+
+	remain = fp->obj.objsize - fp->fptr;
+	if (btf > remain) btf = (UINT)remain;			/* Truncate btf by remaining bytes */
+
+	for ( ;  btf && (*func)(0, 0);					/* Repeat until all data transferred or stream goes busy */
+		fp->fptr += rcnt, *bf += rcnt, btf -= rcnt) {
+		csect = (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Sector offset in the cluster */
+		if (fp->fptr % SS(fs) == 0 && csect == 0) {	/* On the cluster boundary? */
+#if FF_USE_FASTSEEK
+			if (fp->fptr != 0 && fp->cltbl) {
+				clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
+			} else
+#endif
+			{
+				clst = (fp->fptr == 0) ?			/* On the top of the file? */
+					fp->obj.sclust : get_fat(&fp->obj, fp->clust);
+			}
+			if (clst <= 1) ABORT(fs, FR_INT_ERR);
+			if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+			fp->clust = clst;						/* Update current cluster */
+		}
+		sect = clst2sect(fs, fp->clust);			/* Get current data sector */
+		if (sect == 0) ABORT(fs, FR_INT_ERR);
+		sect += csect;
+		cc = (fp->fptr % SS(fs) == 0) ? btf / SS(fs) : 0;	/* Number of whole sectors to forward */
+		if (cc > szbuf / SS(fs)) cc = szbuf / SS(fs);		/* Clip it by the buffer size */
+		if (cc > 0) {								/* Read a run of contiguous sectors into the buffer */
+			n = fs->csize - csect;					/* Sectors to the end of the cluster */
+			for (clst = fp->clust; n < cc; n += fs->csize, clst = nclst) {	/* Extend the run while the next cluster follows */
+#if FF_USE_FASTSEEK
+				if (fp->cltbl) {
+					nclst = clmt_clust(fp, fp->fptr + (FSIZE_t)n * SS(fs));
+				} else
+#endif
+				{
+					nclst = get_fat(&fp->obj, clst);
+				}
+				if (nclst != clst + 1) break;		/* Not contiguous (or end of chain or error) */
+			}
+			if (cc > n) cc = n;
+			if (disk_read(fs->pdrv, buff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#if !FF_FS_READONLY		/* Replace one of the read sectors with cached data if it contains a dirty sector */
+#if FF_FS_TINY
+			if (fs->wflag && fs->winsect - sect < cc) {
+				mem_cpy(buff + ((fs->winsect - sect) * SS(fs)), fs->win, SS(fs));
+			}
+#else
+			if ((fp->flag & FA_DIRTY) && fp->sect - sect < cc) {
+				mem_cpy(buff + ((fp->sect - sect) * SS(fs)), fp->buf, SS(fs));
+			}
+#endif
+#endif
+			dbuf = buff;
+			rcnt = SS(fs) * cc;
+		} else {									/* Forward a partial sector from the sector buffer */
+#if FF_FS_TINY
+			if (move_window(fs, sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window to the file data */
+			dbuf = fs->win;
+#else
+			if (fp->sect != sect) {		/* Fill sector cache with file data */
+#if !FF_FS_READONLY
+				if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
+					if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+					fp->flag &= (BYTE)~FA_DIRTY;
+				}
+#endif
+				if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+			}
+			dbuf = fp->buf;
+#endif
+			fp->sect = sect;
+			dbuf += (UINT)fp->fptr % SS(fs);
+			rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
+			if (rcnt > btf) rcnt = btf;				/* Clip it by btf if needed */
+		}
+		rcnt = (*func)(dbuf, rcnt);					/* Forward the file data */
+		if (rcnt == 0) ABORT(fs, FR_INT_ERR);
+		/* Move to the cluster of the last forwarded byte (the run is contiguous) */
+		fp->clust += (DWORD)(((DWORD)csect * SS(fs) + (UINT)fp->fptr % SS(fs) + rcnt - 1) / ((DWORD)fs->csize * SS(fs)));
+	}
+
+	LEAVE_FF(fs, FR_OK);
+}
 #endif /* FF_USE_FORWARD */
 
 
@@ -6835,6 +8388,9 @@ FRESULT f_setcp (
 	if (validcp[i] != cp) return FR_INVALID_PARAMETER;	/* Not found? */
 
 	CodePage = cp;
+#if FF_USE_LFN && FF_CVT_DIRECT
+	ff_cvtinit(cp);		/* Expand the code conversion tables */
+#endif
 	if (cp >= 900) {	/* DBCS */
 		ExCvt = 0;
 		DbcTbl = tables[i];
@@ -127,6 +127,23 @@ typedef DWORD LBA_t;
 
 
 
+#if FF_PATH_CACHE
+/* Path cache entry structure (FFPCENT) */
+
+typedef struct {
+	DWORD	dir;			/* Start cluster of the containing directory (0:root, 0xFFFFFFFF:empty slot) */
+	DWORD	hash[2];		/* Hash values of the name */
+	DWORD	sclust;			/* Object start cluster */
+	DWORD	age;			/* Last use */
+	LBA_t	sect;			/* Sector of the first entry of the object (LFN or SFN) */
+	DWORD	clust;			/* Cluster of the first entry of the object */
+	DWORD	dptr;			/* Offset of the first entry of the object in the directory */
+	BYTE	attr;			/* Object attribute */
+} FFPCENT;
+#endif
+
+
+
 /* Filesystem object structure (FATFS) */
 
 typedef struct {
@@ -153,6 +170,22 @@ typedef struct {
 #if !FF_FS_READONLY
 	DWORD	last_clst;		/* Last allocated cluster */
 	DWORD	free_clst;		/* Number of free clusters */
+	DWORD	fsc_clst;		/* Free cluster count: next FAT entry to be scanned (0:no scan in progress) */
+	DWORD	fsc_nfree;		/* Free cluster count: free clusters found before fsc_clst */
+#if FF_USE_BATCH
+	BYTE	batch;			/* Nesting level of open batches (0:not in a batch) */
+#endif
+#if FF_FAT_DEFER
+	BYTE	fm_pend;		/* Deferred FAT mirroring: 1:the 2nd FAT is out of date */
+	BYTE	fm_fsi;			/* Deferred FAT mirroring: 1:the state is marked in the FSInfo */
+	BYTE	fm_shift;		/* Deferred FAT mirroring: log2 of number of FAT sectors per bit */
+	WORD	fm_nsync;		/* Deferred FAT mirroring: number of syncs since the last mirroring */
+	BYTE	fm_map[FF_FAT_DEFER];	/* Deferred FAT mirroring: map of FAT sectors to be mirrored */
+#endif
+#if FF_FAT_BITMAP
+	BYTE	bm_shift;		/* Free cluster bitmap: log2 of number of clusters per bit */
+	DWORD	bm[(FF_FAT_BITMAP + 3) / 4];	/* Free cluster bitmap (b=0:all clusters of the group are in use) */
+#endif
 #endif
 #if FF_FS_RPATH
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
@@ -173,6 +206,29 @@ typedef struct {
 #endif
 	LBA_t	winsect;		/* Current sector appearing in the win[] */
 	BYTE	win[FF_MAX_SS];	/* Disk access window for Directory, FAT (and file data at tiny cfg) */
+#if FF_WIN_CACHE
+	DWORD	wc_tick;		/* Sector cache: use counter */
+	DWORD	wc_hit;			/* Sector cache: number of hits */
+	DWORD	wc_miss;		/* Sector cache: number of misses */
+	DWORD	wc_wback;		/* Sector cache: number of sectors written back */
+	LBA_t	wc_sect[FF_WIN_CACHE];	/* Sector cache: sector in each slot ((LBA_t)0 - 1:empty) */
+	DWORD	wc_age[FF_WIN_CACHE];	/* Sector cache: last use of each slot */
+	BYTE	wc_flag[FF_WIN_CACHE];	/* Sector cache: flags of each slot (b0:dirty) */
+	BYTE	wc_buf[FF_WIN_CACHE][FF_MAX_SS];	/* Sector cache: data of each slot */
+#endif
+#if FF_DIR_INDEX
+	DWORD	dix_sclust;		/* Directory index: start cluster of the indexed directory (0xFFFFFFFF:none) */
+	DWORD	dix_cand;		/* Directory index: directory to be indexed at next lookup */
+	BYTE	dix_stat;		/* Directory index: 1:complete, 2:some objects not in the index */
+	UINT	dix_used;		/* Directory index: number of used slots */
+	DWORD	dix_tbl[FF_DIR_INDEX];	/* Directory index: hash (b31-16, 0:empty or removed) and entry index (b15-0) */
+#endif
+#if FF_PATH_CACHE
+	DWORD	pc_tick;		/* Path cache: use counter */
+	DWORD	pc_hit;			/* Path cache: number of hits */
+	DWORD	pc_miss;		/* Path cache: number of misses */
+	FFPCENT	pc_ent[FF_PATH_CACHE];	/* Path cache: entries */
+#endif
 } FATFS;
 
 
@@ -302,12 +358,14 @@ typedef enum {
 /* FatFs module application interface                           */
 
 FRESULT f_open (FIL* fp, const TCHAR* path, BYTE mode);				/* Open or create a file */
+FRESULT f_openat (FIL* fp, DIR* dp, const TCHAR* path, BYTE mode);	/* Open or create a file relative to an open directory */
 FRESULT f_close (FIL* fp);											/* Close an open file object */
 FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br);			/* Read data from the file */
 FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);	/* Write data to the file */
 FRESULT f_lseek (FIL* fp, FSIZE_t ofs);								/* Move file pointer of the file object */
 FRESULT f_truncate (FIL* fp);										/* Truncate the file */
 FRESULT f_sync (FIL* fp);											/* Flush cached data of the writing file */
+FRESULT f_rawadvance (FIL* fp, FSIZE_t ofs, BYTE wr);					/* Advance the file pointer over sectors transferred outside FatFs */
 FRESULT f_opendir (DIR* dp, const TCHAR* path);						/* Open a directory */
 FRESULT f_closedir (DIR* dp);										/* Close an open directory */
 FRESULT f_readdir (DIR* dp, FILINFO* fno);							/* Read a directory item */
@@ -323,9 +381,12 @@ FRESULT f_chdir (const TCHAR* path);								/* Change current directory */
 FRESULT f_chdrive (const TCHAR* path);								/* Change current drive */
 FRESULT f_getcwd (TCHAR* buff, UINT len);							/* Get current directory */
 FRESULT f_getfree (const TCHAR* path, DWORD* nclst, FATFS** fatfs);	/* Get number of free clusters on the drive */
+FRESULT f_scanfree (const TCHAR* path, UINT nsect, DWORD* nclst, DWORD* nleft);	/* Count free clusters on the drive step by step */
+FRESULT f_batch (const TCHAR* path, BYTE opt);						/* Begin/Commit a batch of updates */
 FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn);	/* Get volume label */
 FRESULT f_setlabel (const TCHAR* label);							/* Set volume label */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf);	/* Forward data to the stream */
+FRESULT f_forwardrun (FIL* fp, UINT(*func)(const BYTE*,UINT), BYTE* buff, UINT szbuf, UINT btf, UINT* bf);	/* Forward runs of contiguous sectors to the stream */
 FRESULT f_expand (FIL* fp, FSIZE_t fsz, BYTE opt);					/* Allocate a contiguous block to the file */
 FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);			/* Mount/Unmount a logical drive */
 FRESULT f_mkfs (const TCHAR* path, const MKFS_PARM* opt, void* work, UINT len);	/* Create a FAT volume */
@@ -365,6 +426,9 @@ DWORD get_fattime (void);
 WCHAR ff_oem2uni (WCHAR oem, WORD cp);	/* OEM code to Unicode conversion */
 WCHAR ff_uni2oem (DWORD uni, WORD cp);	/* Unicode to OEM code conversion */
 DWORD ff_wtoupper (DWORD uni);			/* Unicode upper-case conversion */
+#if FF_CVT_DIRECT && FF_CODE_PAGE == 0
+void ff_cvtinit (WORD cp);				/* Expand the conversion tables of the code page */
+#endif
 #endif
 #if FF_USE_LFN == 3						/* Dynamic memory allocation */
 void* ff_memalloc (UINT msize);			/* Allocate memory block */
@@ -63,7 +63,30 @@
 
 
 #define FF_USE_FORWARD	0
-/* This option switches f_forward() function. (0:Disable or 1:Enable) */
+/* This option switches f_forward() and f_forwardrun() functions. (0:Disable or 1:Enable) */
+
+
+#define FF_USE_FREESCAN	0
+/* This option switches f_scanfree() function, which counts free clusters on the FAT
+/  a given number of sectors per call. (0:Disable or 1:Enable) When the free cluster
+/  count in the FSINFO is trusted (FF_FS_NOFSINFO bit0 = 0), f_getfree() returns it
+/  until the scan verifies or corrects it. Otherwise the count is unknown until the
+/  scan is completed.
+/  Also FF_FS_READONLY needs to be 0 to enable this option. */
+
+
+#define FF_USE_BATCH	0
+/* This option switches f_batch() function, which opens and commits a batch of
+/  updates. (0:Disable or 1:Enable) While a batch is open, the dirty directory and
+/  FAT sectors stay in memory, FSINFO is not updated and CTRL_SYNC is not issued.
+/  At commit, the deferred sectors are written back in the order of FF_WIN_CACHE.
+/  Use it with FF_WIN_CACHE > 0 to keep more than one dirty sector in memory. On
+/  power loss in a batch, files created or changed in it can be missing or have
+/  their old size, their clusters become lost clusters and the FSINFO free count
+/  can be stale. A cluster is marked in use in the FAT before a link or an entry
+/  refers to it, and an entry removed by f_unlink() is written before its clusters
+/  are freed.
+/  Also FF_FS_READONLY needs to be 0 to enable this option. */
 
 
 /*---------------------------------------------------------------------------/
@@ -100,6 +123,29 @@
 */
 
 
+#define FF_CVT_DIRECT	0
+/* This option switches the OEM code <==> Unicode conversion of the LFN between
+/  small and fast. (0:Search in the code tables or 1:Direct lookup tables)
+/
+/  When enabled, the conversion of a character takes constant time instead of
+/  a linear search of 128 codes (SBCS) or a binary search of up to 16 steps
+/  (DBCS). For a fixed code page, two-level lookup tables are used in place of
+/  the code tables. They are constant and take about 2.5 KB more ROM for SBCS
+/  and 6 KB more for 932, and 22 to 75 KB less for 936, 949 and 950. When
+/  FF_CODE_PAGE is 0, the code tables of the code page are expanded into 138 KB
+/  of RAM at f_mount() or f_setcp(). It has no effect when FF_USE_LFN is 0. */
+
+
+#define FF_UPCASE_DIRECT	0
+/* This option switches the Unicode up-case conversion of the LFN between small
+/  and fast. (0:Compressed table or 1:Direct lookup table)
+/
+/  The characters in U+0000 - U+00FF are always up-converted without the table.
+/  When enabled, the other characters are up-converted with a two-level lookup
+/  table instead of walking the compressed conversion table, at the cost of
+/  6.9 KB in the .const section instead of 1 KB. */
+
+
 //#define	FF_USE_LFN	0
 #define	FF_USE_LFN	1
 #define FF_MAX_LFN		255
@@ -158,7 +204,7 @@
 /* This option configures support for relative path.
 /
 /   0: Disable relative path and remove related functions.
-/   1: Enable relative path. f_chdir() and f_chdrive() are available.
+/   1: Enable relative path. f_chdir(), f_chdrive() and f_openat() are available.
 /   2: f_getcwd() function is available in addition to 1.
 */
 
@@ -265,6 +311,69 @@
 */
 
 
+#define FF_WIN_CACHE	0
+/* This option specifies the number of sectors of a cache put behind the disk access
+/  window of each volume (0:Disable or 1..255). Sectors of FAT, directories and FSINFO
+/  leaving the window are kept in the cache and come back without disk access. Dirty
+/  sectors are written back when they are evicted (least recently used clean sectors
+/  go first) or when the filesystem is synchronized, FAT sectors from the end of the
+/  FAT and then other sectors in ascending LBA order. Each sector of cache takes
+/  FF_MAX_SS bytes in the filesystem object. The hit, miss and write-back counters are
+/  available in the filesystem object (wc_hit, wc_miss and wc_wback). At tiny buffer
+/  configuration, only sectors before the data area are cached. */
+
+
+#define FF_FAT_BITMAP	0
+/* This option specifies the size in byte of the in-RAM free cluster bitmap of each
+/  volume (0:Disable or 4..). It is used on FAT12/16/32 volumes to find free clusters
+/  without walking the FAT entry by entry. Each bit covers as many clusters as needed
+/  to cover the whole volume in the given size (a bit per cluster needs n_clusters / 8
+/  bytes). A bit is cleared when all clusters of its group are found in use and set
+/  again when a cluster of the group is freed. The bitmap is filled at mount with all
+/  bits set and gets accurate as allocation progresses or by f_getfree(). */
+
+
+#define FF_FAT_DEFER	0
+#define FF_FAT_DEFER_SYNC	16
+/* FF_FAT_DEFER specifies the size in byte of the map of FAT sectors to be mirrored
+/  of each volume (0:Disable or 1..). When enabled, a FAT sector written on a volume
+/  with two FATs is marked in the map instead of being written into the 2nd FAT at
+/  once, and the marked sectors are copied into the 2nd FAT in ascending order at
+/  every FF_FAT_DEFER_SYNC-th synchronization (f_sync(), f_close() and so on) and at
+/  unmount (0:Only at unmount). Each bit covers as many FAT sectors as needed to cover
+/  the whole FAT in the given size. A mirroring takes two sector writes more than the
+/  marked sectors, so FF_FAT_DEFER_SYNC should not be too small. While the 2nd FAT is
+/  out of date on a FAT32 volume, a reserved field of the FSInfo sector is marked, and
+/  the 2nd FAT is rebuilt from the 1st FAT at the next mount if the mirroring has been
+/  interrupted. On FAT12/16 volumes and FAT32 volumes without the FSInfo, the FATs are
+/  compared at every mount instead, which reads both FATs.
+/  Another OS does not know the marker and may find the FATs different after a power
+/  loss, so keep this option 0 for a card that is also read on a PC or a camera. */
+
+
+#define FF_DIR_INDEX	0
+/* This option specifies the number of slots of the in-RAM name index of each volume
+/  (0:Disable or 16..). When a lookup in a FAT12/16/32 directory walked more than 64
+/  entries, the directory is indexed in a pass at its next lookup: each slot holds a
+/  hash of a case-folded LFN or of an SFN and the location of the entry, so following
+/  lookups in the directory read only the matched entries. Objects created or removed in the indexed
+/  directory are added or removed to keep it coherent. An object takes one or two slots.
+/  When the index is more than 3/4 full, a name not found in it is searched on the
+/  directory as usual. Each slot takes 4 bytes. This option requires FF_USE_LFN >= 1. */
+
+
+#define FF_PATH_CACHE	0
+/* This option specifies the number of entries of the path cache of each volume
+/  (0:Disable or 1..). When enabled, the result of looking up a name in a FAT12/16/32
+/  directory is kept in the cache with the start cluster of the directory and hash
+/  values of the name: the location of the entry and the start cluster of a found
+/  object. A later path with the same segment gets into a sub-directory without
+/  reading the directory, or finds the entry by a sector read and a check of the
+/  name. A name that is not found is not cached. The least recently used entry is
+/  replaced. All entries are discarded when an object is created or removed on the
+/  volume. Each entry takes 36 or 40 bytes. */
+
+
 #define FF_FS_LOCK		0
 /* The option FF_FS_LOCK switches file lock function to control duplicated file open
 /  and illegal operation to open objects. This option must be 0 when FF_FS_READONLY
@@ -278,9 +387,30 @@
 
 
 /* #include <somertos.h>	// O/S definitions */
+//#define FF_FS_REENTRANT	0
+#if defined(ESP32)
+#define FF_FS_REENTRANT	1
+#else
 #define FF_FS_REENTRANT	0
+#endif
 #define FF_FS_TIMEOUT	1000
-#define FF_SYNC_t		HANDLE
+//#define FF_SYNC_t		HANDLE
+#if FF_FS_REENTRANT
+#if defined(ESP32) || defined(INC_FREERTOS_H)
+#if defined(ESP32)
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#endif
+#define FF_SYNC_t		SemaphoreHandle_t
+#else
+#include <pthread.h>
+#define FF_SYNC_t		pthread_mutex_t*
+#endif
+#if FF_USE_LFN == 1
+#undef FF_USE_LFN
+#define FF_USE_LFN		2
+#endif
+#endif
 /* The option FF_FS_REENTRANT switches the re-entrancy (thread safe) of the FatFs
 /  module itself. Note that regardless of this option, file access to different
 /  volume is always re-entrant and volume control functions, f_mount(), f_mkfs()
@@ -296,7 +426,13 @@
 /  The FF_FS_TIMEOUT defines timeout period in unit of time tick.
 /  The FF_SYNC_t defines O/S dependent sync object type. e.g. HANDLE, ID, OS_EVENT*,
 /  SemaphoreHandle_t and etc. A header file for O/S definitions needs to be
-/  included somewhere in the scope of ff.h. */
+/  included somewhere in the scope of ff.h.
+/
+/  Re-entrancy is enabled on ESP32, where tasks of FreeRTOS can share the card.
+/  ffsystem.c has handlers for a mutex of FreeRTOS (ESP32 or when FreeRTOS.h
+/  is included before) and for a mutex of POSIX threads (other systems, where
+/  FF_FS_TIMEOUT is in milliseconds). The static LFN working buffer can't be
+/  shared by tasks, so FF_USE_LFN 1 is turned into 2 (buffer on the stack). */
 
 
 
@@ -38,6 +38,20 @@ void ff_memfree (
 
 #if FF_FS_REENTRANT	/* Mutal exclusion */
 
+/* The sync object is a mutex of FreeRTOS (ESP32) or of POSIX threads, as
+/  selected for FF_SYNC_t in ffconf.h. Samples for other O/S are left as
+/  comments. */
+
+#if defined(ESP32) || defined(INC_FREERTOS_H)
+#define SYNC_FREERTOS	1
+#else
+#define SYNC_FREERTOS	0
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+
 /*------------------------------------------------------------------------*/
 /* Create a Synchronization Object                                        */
 /*------------------------------------------------------------------------*/
@@ -54,9 +68,24 @@ int ff_cre_syncobj (	/* 1:Function succeeded, 0:Could not create the sync object
 	FF_SYNC_t* sobj		/* Pointer to return the created sync object */
 )
 {
+	(void)vol;
+#if SYNC_FREERTOS
+	/* FreeRTOS */
+	*sobj = xSemaphoreCreateMutex();
+	return (int)(*sobj != NULL);
+#else
+	/* POSIX threads */
+	*sobj = (pthread_mutex_t*)malloc(sizeof (pthread_mutex_t));
+	if (*sobj != NULL && pthread_mutex_init(*sobj, NULL) != 0) {
+		free(*sobj);
+		*sobj = NULL;
+	}
+	return (int)(*sobj != NULL);
+#endif
+
 	/* Win32 */
-	*sobj = CreateMutex(NULL, FALSE, NULL);
-	return (int)(*sobj != INVALID_HANDLE_VALUE);
+//	*sobj = CreateMutex(NULL, FALSE, NULL);
+//	return (int)(*sobj != INVALID_HANDLE_VALUE);
 
 	/* uITRON */
 //	T_CSEM csem = {TA_TPRI,1,1};
@@ -68,10 +97,6 @@ int ff_cre_syncobj (	/* 1:Function succeeded, 0:Could not create the sync object
 //	*sobj = OSMutexCreate(0, &err);
 //	return (int)(err == OS_NO_ERR);
 
-	/* FreeRTOS */
-//	*sobj = xSemaphoreCreateMutex();
-//	return (int)(*sobj != NULL);
-
 	/* CMSIS-RTOS */
 //	*sobj = osMutexCreate(&Mutex[vol]);
 //	return (int)(*sobj != NULL);
@@ -90,8 +115,19 @@ int ff_del_syncobj (	/* 1:Function succeeded, 0:Could not delete due to an error
 	FF_SYNC_t sobj		/* Sync object tied to the logical drive to be deleted */
 )
 {
+#if SYNC_FREERTOS
+	/* FreeRTOS */
+	vSemaphoreDelete(sobj);
+	return 1;
+#else
+	/* POSIX threads */
+	if (pthread_mutex_destroy(sobj) != 0) return 0;	/* Still locked? */
+	free(sobj);
+	return 1;
+#endif
+
 	/* Win32 */
-	return (int)CloseHandle(sobj);
+//	return (int)CloseHandle(sobj);
 
 	/* uITRON */
 //	return (int)(del_sem(sobj) == E_OK);
@@ -101,10 +137,6 @@ int ff_del_syncobj (	/* 1:Function succeeded, 0:Could not delete due to an error
 //	OSMutexDel(sobj, OS_DEL_ALWAYS, &err);
 //	return (int)(err == OS_NO_ERR);
 
-	/* FreeRTOS */
-//  vSemaphoreDelete(sobj);
-//	return 1;
-
 	/* CMSIS-RTOS */
 //	return (int)(osMutexDelete(sobj) == osOK);
 }
@@ -121,8 +153,31 @@ int ff_req_grant (	/* 1:Got a grant to access the volume, 0:Could not get a gran
 	FF_SYNC_t sobj	/* Sync object to wait */
 )
 {
+#if SYNC_FREERTOS
+	/* FreeRTOS */
+	return (int)(xSemaphoreTake(sobj, FF_FS_TIMEOUT) == pdTRUE);
+#else
+	/* POSIX threads (FF_FS_TIMEOUT in ms) */
+	if (pthread_mutex_trylock(sobj) == 0) return 1;	/* Not locked, no need of the time */
+#if defined(_POSIX_TIMEOUTS) && _POSIX_TIMEOUTS > 0
+	{
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += FF_FS_TIMEOUT / 1000;
+		ts.tv_nsec += (long)(FF_FS_TIMEOUT % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++; ts.tv_nsec -= 1000000000;
+		}
+		return (int)(pthread_mutex_timedlock(sobj, &ts) == 0);
+	}
+#else
+	return (int)(pthread_mutex_lock(sobj) == 0);
+#endif
+#endif
+
 	/* Win32 */
-	return (int)(WaitForSingleObject(sobj, FF_FS_TIMEOUT) == WAIT_OBJECT_0);
+//	return (int)(WaitForSingleObject(sobj, FF_FS_TIMEOUT) == WAIT_OBJECT_0);
 
 	/* uITRON */
 //	return (int)(wai_sem(sobj) == E_OK);
@@ -132,9 +187,6 @@ int ff_req_grant (	/* 1:Got a grant to access the volume, 0:Could not get a gran
 //	OSMutexPend(sobj, FF_FS_TIMEOUT, &err));
 //	return (int)(err == OS_NO_ERR);
 
-	/* FreeRTOS */
-//	return (int)(xSemaphoreTake(sobj, FF_FS_TIMEOUT) == pdTRUE);
-
 	/* CMSIS-RTOS */
 //	return (int)(osMutexWait(sobj, FF_FS_TIMEOUT) == osOK);
 }
@@ -150,8 +202,16 @@ void ff_rel_grant (
 	FF_SYNC_t sobj	/* Sync object to be signaled */
 )
 {
+#if SYNC_FREERTOS
+	/* FreeRTOS */
+	xSemaphoreGive(sobj);
+#else
+	/* POSIX threads */
+	pthread_mutex_unlock(sobj);
+#endif
+
 	/* Win32 */
-	ReleaseMutex(sobj);
+//	ReleaseMutex(sobj);
 
 	/* uITRON */
 //	sig_sem(sobj);
@@ -159,9 +219,6 @@ void ff_rel_grant (
 	/* uC/OS-II */
 //	OSMutexPost(sobj);
 
-	/* FreeRTOS */
-//	xSemaphoreGive(sobj);
-
 	/* CMSIS-RTOS */
 //	osMutexRelease(sobj);
 }